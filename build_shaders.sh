@@ -1,7 +0,0 @@
-#!/bin/sh
-
-cd shaders
-glslc -c *.vert
-glslc -c *.frag
-
-cd ..
\ No newline at end of file
@@ -30,8 +30,9 @@ int main() {
 	const int screenHeight = 600;
 	auto context = azu::Context("Bunnymark", screenWidth, screenHeight);
 
-	context.CreateTextureFromFile("alien", "examples/res/smug_alien.png");
-	azu::Vec2 alienSize = context.GetTextureDimensions("alien");
+	azu::TextureHandle alien =
+	    context.CreateTextureFromFile("examples/res/smug_alien.png").value();
+	azu::Vec2 alienSize = context.GetTextureDimensions(alien);
 	alienSize.x         = alienSize.x / 30;
 	alienSize.y         = alienSize.y / 30;
 
@@ -91,7 +92,7 @@ int main() {
 
 		for (size_t i = 0; i < bunnies.size(); i++) {
 			context.DrawQuad(azu::Quad::create(bunnies[i].position, alienSize),
-			                 "alien");
+			                 alien);
 		}
 
 		printf("bunnies: %zu\n", bunnies.size());
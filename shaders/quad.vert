@@ -2,88 +2,82 @@
 
 layout(push_constant) uniform constants {
 	mat4 projectionMatrix;
+	// QuadDrawOrder, see vk_context.h
+	int firstQuad;
+	int step;
+	uint depthOffset;
 }
 pushConstants;
 
-struct QuadCornerValues {
-	float tl; // top left
-	float tr; // top right
-	float bl; // bottom left
-	float br; // bottom right
-};
-
-struct DrawQuadOptions {
-	QuadCornerValues radius;
-	float opacity;
-};
-
 struct Quad {
 	vec2 pos;
 	vec2 size;
 };
 
+// packed the same way as QuadData in util/quad_data.h
 struct QuadData {
 	Quad quad;
-	vec4 color;
-	int textureId;
-	int fillType;
-	DrawQuadOptions options;
+	uvec2 fill;  // color as RGBA8, or the UV rect as unorm16s
+	uint radius; // corner radii as unorm8s (tl, tr, bl, br)
+	uint packed; // texture index (16), opacity (8), fill type (7), opaque (1)
 };
 
-layout(location = 0) out vec2 outUv;
-layout(location = 1) out QuadData outQuadData;
+// only what the fragment shader needs, the rest of QuadData stays here
+layout(location = 0) out vec2 outLocalPos; // in pixels, from the center
+layout(location = 1) out vec2 outTextureUv;
+layout(location = 2) flat out vec2 outHalfSize;
+layout(location = 3) flat out vec4 outRadius; // in pixels (tl, tr, bl, br)
+layout(location = 4) flat out uint outColor;
+layout(location = 5) flat out uint outPacked;
 
-layout(std140, set = 0, binding = 0) readonly buffer QuadsBuffer {
+layout(std430, set = 0, binding = 0) readonly buffer QuadsBuffer {
 	QuadData quads[];
 }
 quadsBuffer;
 
-void main() {
-	QuadData d = quadsBuffer.quads[gl_VertexIndex / 6];
+// Every quad is an instance of a 4 vertex triangle strip, so each corner is
+// only shaded once
+const vec2 corners[4] = vec2[4](vec2(0.0, 0.0), // top left
+                                vec2(1.0, 0.0), // top right
+                                vec2(0.0, 1.0), // bottom left
+                                vec2(1.0, 1.0)  // bottom right
+);
 
-	float x = d.quad.pos.x;
-	float y = d.quad.pos.y;
-	float w = d.quad.size.x;
-	float h = d.quad.size.y;
+#define FILL_TYPE_TEXTURE 2u
 
-	vec2 tl = vec2(x, y);
-	vec2 tr = vec2(x + w, y);
-	vec2 bl = vec2(x, y + h);
-	vec2 br = vec2(x + w, y + h);
+void main() {
+	uint quadIndex =
+	    uint(pushConstants.firstQuad + pushConstants.step * gl_InstanceIndex);
+	QuadData d = quadsBuffer.quads[quadIndex];
 
-	if (w > h) {
-		tl.y = y + h / 2 - w / 2;
-		tr.y = y + h / 2 - w / 2;
-		bl.y = y + h - h / 2 + w / 2;
-		br.y = y + h - h / 2 + w / 2;
-	} else {
-		tl.x = x + w / 2 - h / 2;
-		bl.x = x + w / 2 - h / 2;
-		tr.x = x + w - w / 2 + h / 2;
-		br.x = x + w - w / 2 + h / 2;
-	}
+	vec2 corner = corners[gl_VertexIndex];
 
-	const vec3 vertices[6] = vec3[6](vec3(tl, 0.0), // top left
-	                                 vec3(tr, 0.0), // top right
-	                                 vec3(bl, 0.0), // bottom left
+	// the quad is rasterized at its exact size, the rounded corners are cut
+	// out by the fragment shader
+	gl_Position = pushConstants.projectionMatrix *
+	              vec4(d.quad.pos + corner * d.quad.size, 0.0, 1.0);
 
-	                                 vec3(bl, 0.0), // bottom left
-	                                 vec3(br, 0.0), // bottom right
-	                                 vec3(tr, 0.0)  // top right
-	);
+	// later quads are in front, no matter which order they're drawn in. The
+	// steps are exactly representable, so no two quads share a depth (up to
+	// 2^23 of them, Context::_layoutLayers throws beyond that)
+	uint depthIndex = pushConstants.depthOffset + quadIndex;
+	gl_Position.z   = min(float(depthIndex + 1) * exp2(-23.0), 1.0);
 
-	const vec2 uv[6] = vec2[6](vec2(0.0, 0.0), // top left
-	                           vec2(1.0, 0.0), // top right
-	                           vec2(0.0, 1.0), // bottom left
+	vec2 halfSize = d.quad.size / 2.0;
+	outLocalPos   = (corner - 0.5) * d.quad.size;
+	outHalfSize   = halfSize;
 
-	                           vec2(0.0, 1.0), // bottom left
-	                           vec2(1.0, 1.0), // bottom right
-	                           vec2(1.0, 0.0)  // top right
-	);
+	// the radii are fractions of half the shorter side
+	outRadius = unpackUnorm4x8(d.radius) * min(halfSize.x, halfSize.y);
 
-	// output the position of each vertex
-	gl_Position = pushConstants.projectionMatrix *
-	              vec4(vertices[gl_VertexIndex % 6], 1.0f);
-	outUv       = uv[gl_VertexIndex % 6];
-	outQuadData = d;
+	if (((d.packed >> 24) & 0x7Fu) == FILL_TYPE_TEXTURE) {
+		vec4 uvRect =
+		    vec4(unpackUnorm2x16(d.fill.x), unpackUnorm2x16(d.fill.y));
+		outTextureUv = uvRect.xy + corner * uvRect.zw;
+	} else {
+		outTextureUv = vec2(0.0);
+	}
+
+	outColor  = d.fill.x;
+	outPacked = d.packed;
 }
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "azu.h"
+
+#include "util/util.h"
+#include "vk_init/vk_init.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+using namespace azu;
+
+bool Context::_packIntoAtlas(TextureHandle handle, Texture &texture,
+                             const uint8_t *pixels, uint32_t width,
+                             uint32_t height) {
+	if (!_useTextureAtlas || width > ATLAS_MAX_ENTRY_SIZE ||
+	    height > ATLAS_MAX_ENTRY_SIZE) {
+		return false;
+	}
+
+	// every entry gets a 1 pixel border around it that repeats its edge
+	// pixels, so filtering at the edges never picks up the neighbours
+	const uint32_t paddedWidth  = width + 2;
+	const uint32_t paddedHeight = height + 2;
+
+	// try the existing pages first, then a new page, and if there's no room
+	// for one the least recently used page that no frame in flight can be
+	// drawing from
+	uint32_t pageIndex = NO_ATLAS_PAGE;
+	std::optional<std::pair<uint32_t, uint32_t>> position;
+
+	for (uint32_t i = 0; i < _atlasPages.size() && !position.has_value(); i++) {
+		position  = _atlasPages[i].packer.Pack(paddedWidth, paddedHeight);
+		pageIndex = i;
+	}
+
+	if (!position.has_value() && _atlasPages.size() < ATLAS_MAX_PAGES) {
+		std::optional<uint32_t> newPage = _createAtlasPage();
+		if (newPage.has_value()) {
+			pageIndex = newPage.value();
+			position  = _atlasPages[pageIndex].packer.Pack(paddedWidth,
+			                                               paddedHeight);
+		}
+	}
+
+	if (!position.has_value()) {
+		const uint32_t framesInFlight = (uint32_t)Vk.Frames.size();
+
+		pageIndex = NO_ATLAS_PAGE;
+		for (uint32_t i = 0; i < _atlasPages.size(); i++) {
+			const AtlasPage &page = _atlasPages[i];
+			if (page.lastUsedFrame + framesInFlight > FrameNumber) {
+				continue;
+			}
+
+			// sprites keep drawing from their texture without touching it
+			bool pinned = std::any_of(
+			    page.entries.begin(), page.entries.end(),
+			    [&](TextureHandle entry) {
+				    const Texture *entryTexture = _getTexture(entry);
+				    return entryTexture && entryTexture->atlasPage == i &&
+				           entryTexture->spriteCount > 0;
+			    });
+			if (pinned) {
+				continue;
+			}
+
+			if (pageIndex == NO_ATLAS_PAGE ||
+			    page.lastUsedFrame < _atlasPages[pageIndex].lastUsedFrame) {
+				pageIndex = i;
+			}
+		}
+
+		if (pageIndex == NO_ATLAS_PAGE) {
+			return false;
+		}
+
+		_evictAtlasPage(pageIndex);
+		position =
+		    _atlasPages[pageIndex].packer.Pack(paddedWidth, paddedHeight);
+	}
+
+	auto [x, y] = position.value();
+
+	// build the padded copy of the pixels
+	std::vector<uint8_t> padded((size_t)paddedWidth * paddedHeight * 4);
+	for (uint32_t row = 0; row < paddedHeight; row++) {
+		uint32_t sourceRow = std::min(std::max(row, 1u) - 1, height - 1);
+
+		uint8_t *destination  = padded.data() + (size_t)row * paddedWidth * 4;
+		const uint8_t *source = pixels + (size_t)sourceRow * width * 4;
+
+		memcpy(destination + 4, source, (size_t)width * 4);
+		memcpy(destination, source, 4);
+		memcpy(destination + (size_t)(width + 1) * 4,
+		       source + (size_t)(width - 1) * 4, 4);
+	}
+
+	AtlasPage &page = _atlasPages[pageIndex];
+
+	VkExtent3D regionExtent;
+	regionExtent.width  = paddedWidth;
+	regionExtent.height = paddedHeight;
+	regionExtent.depth  = 1;
+
+	// the first upload into a page transitions it out of
+	// VK_IMAGE_LAYOUT_UNDEFINED
+	bool firstUpload = page.texture.uploadValue == 0;
+
+	texture               = page.texture;
+	texture.width         = width;
+	texture.height        = height;
+	texture.atlasPage     = pageIndex;
+	texture.memorySize    = 0;
+	texture.lastUsedFrame = FrameNumber;
+	texture.uploadValue   = Vk.UploadImageRegion(
+	    page.texture.image, VkOffset3D{(int32_t)x, (int32_t)y, 0},
+	    regionExtent, padded.data(), padded.size(), firstUpload);
+
+	const float pageSize = (float)ATLAS_PAGE_SIZE;
+	texture.uvRect = Quad((float)(x + 1) / pageSize, (float)(y + 1) / pageSize,
+	                      (float)width / pageSize, (float)height / pageSize);
+
+	page.texture.uploadValue = texture.uploadValue;
+	page.lastUsedFrame       = FrameNumber;
+	page.entries.push_back(handle);
+
+	return true;
+}
+
+std::optional<uint32_t> Context::_createAtlasPage() {
+	std::optional<uint32_t> descriptorIndex = _allocateDescriptorIndex();
+	if (!descriptorIndex.has_value()) {
+		return std::nullopt;
+	}
+
+	VkExtent3D imageExtent;
+	imageExtent.width  = ATLAS_PAGE_SIZE;
+	imageExtent.height = ATLAS_PAGE_SIZE;
+	imageExtent.depth  = 1;
+
+	VkFormat imageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+	VkImageCreateInfo imageCreateInfo = vk_init::imageCreateInfo(
+	    imageFormat,
+	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+	    imageExtent);
+
+	uint32_t queueFamilies[2];
+	Vk.FillImageQueueFamilies(imageCreateInfo, queueFamilies);
+
+	AtlasPage page;
+	page.packer = SkylinePacker(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+
+	page.texture.vkId        = descriptorIndex.value();
+	page.texture.width       = ATLAS_PAGE_SIZE;
+	page.texture.height      = ATLAS_PAGE_SIZE;
+	page.texture.uploadValue = 0;
+
+	VmaAllocationCreateInfo imageAllocateInfo = {};
+	imageAllocateInfo.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	VmaAllocationInfo allocationInfo;
+	VK_CHECK(vmaCreateImage(Vk.Allocator, &imageCreateInfo, &imageAllocateInfo,
+	                        &page.texture.image, &page.texture.allocation,
+	                        &allocationInfo));
+
+	// pages count towards the texture memory budget, but are never evicted
+	// by it, they're bounded by ATLAS_MAX_PAGES instead
+	page.texture.memorySize = allocationInfo.size;
+	_textureMemoryUsage += page.texture.memorySize;
+
+	VkImageViewCreateInfo imageViewInfo{};
+	imageViewInfo.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	imageViewInfo.image    = page.texture.image;
+	imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	imageViewInfo.format   = imageFormat;
+	imageViewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageViewInfo.subresourceRange.baseMipLevel   = 0;
+	imageViewInfo.subresourceRange.levelCount     = 1;
+	imageViewInfo.subresourceRange.baseArrayLayer = 0;
+	imageViewInfo.subresourceRange.layerCount     = 1;
+
+	VK_CHECK(vkCreateImageView(Vk.Device, &imageViewInfo, nullptr,
+	                           &page.texture.imageView));
+
+	// pages stay in VK_IMAGE_LAYOUT_GENERAL so new entries can be uploaded
+	// while the rest of the page is being drawn from
+	VkDescriptorImageInfo descriptorImageInfo;
+	descriptorImageInfo.sampler     = Vk.GlobalSampler;
+	descriptorImageInfo.imageView   = page.texture.imageView;
+	descriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	Vk.QueueTextureDescriptorWrite(page.texture.vkId, descriptorImageInfo);
+
+	_atlasPages.push_back(page);
+
+	return (uint32_t)_atlasPages.size() - 1;
+}
+
+void Context::_evictAtlasPage(uint32_t pageIndex) {
+	AtlasPage &page = _atlasPages[pageIndex];
+
+	// the entries keep their handles, they're loaded again (into whichever
+	// page has room by then) after the next time they're drawn
+	for (TextureHandle handle : page.entries) {
+		Texture *texture = _getTexture(handle);
+		if (texture && texture->atlasPage == pageIndex) {
+			texture->resident = false;
+		}
+	}
+
+	page.entries.clear();
+	page.packer.Reset();
+}
@@ -4,12 +4,19 @@
 #include "src/vk_context/vk_context.h"
 #include "util/texture.h"
 #include "util/buffer.h"
+#include "util/ktx2.h"
 #include "util/quad_data.h"
 #include "util/util.h"
 #include "vk_init/vk_init.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <mutex>
 #include <stdexcept>
+#include <unordered_set>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 #define STB_IMAGE_IMPLEMENTATION
@@ -19,29 +26,84 @@
 
 using namespace azu;
 
-Context::Context(std::string_view title, uint32_t width, uint32_t height) {
-	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-		throw SDL_GetError();
+Context::Context(std::string_view title, uint32_t width, uint32_t height,
+                 ContextOptions options) {
+	if (options.headless) {
+		Window = nullptr;
+	} else {
+		if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+			throw SDL_GetError();
+		}
+
+		Window = SDL_CreateWindow(title.data(), SDL_WINDOWPOS_UNDEFINED,
+		                          SDL_WINDOWPOS_UNDEFINED, (int32_t)width,
+		                          (int32_t)height,
+		                          SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+		if (Window == NULL)
+			throw SDL_GetError();
 	}
 
-	Window = SDL_CreateWindow(title.data(), SDL_WINDOWPOS_UNDEFINED,
-	                          SDL_WINDOWPOS_UNDEFINED, (int32_t)width,
-	                          (int32_t)height,
-	                          SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
-	if (Window == NULL)
-		throw SDL_GetError();
+	_useTextureAtlas     = options.useTextureAtlas;
+	_textureMemoryBudget = options.textureMemoryBudget;
 
 	_calculateProjectionMatrix((float)width, (float)height);
 
-	Vk = VkContext(Window, VkExtent2D{width, height}, true);
+	// without a directory (e.g. if there's no home directory) the pipelines
+	// just aren't cached
+	std::string pipelineCacheDirectory;
+	if (options.pipelineCache && options.pipelineCacheDirectory) {
+		pipelineCacheDirectory = options.pipelineCacheDirectory;
+	} else if (options.pipelineCache) {
+		char *prefPath = SDL_GetPrefPath(nullptr, "azu");
+		if (prefPath) {
+			pipelineCacheDirectory = prefPath;
+			SDL_free(prefPath);
+		}
+	}
+
+	Vk = VkContext(Window, VkExtent2D{width, height}, true,
+	               options.framesInFlight,
+	               _toVkPresentMode(options.presentMode),
+	               options.minSwapchainImageCount, options.depthBuffer,
+	               pipelineCacheDirectory.empty()
+	                   ? nullptr
+	                   : pipelineCacheDirectory.c_str());
+
+	_generateMipmaps = options.generateMipmaps &&
+	                   Vk.SupportsMipmapGeneration(VK_FORMAT_R8G8B8A8_SRGB);
 }
 
 Context::~Context() {
-	SDL_DestroyWindow(Window);
+	// textures aren't in the VkContext's deletion queue since they can be
+	// destroyed before it, so whatever is left is cleaned up here
+	vkDeviceWaitIdle(Vk.Device);
+
+	for (TextureSlot &slot : _textureSlots) {
+		if (slot.alive) {
+			_destroyTextureResources(slot.texture);
+		}
+	}
+
+	for (auto [frameNumber, index] : _retiredTextureSlots) {
+		_destroyTextureResources(_textureSlots[index].texture);
+	}
+
+	for (AtlasPage &page : _atlasPages) {
+		vkDestroyImageView(Vk.Device, page.texture.imageView, nullptr);
+		vmaDestroyImage(Vk.Allocator, page.texture.image,
+		                page.texture.allocation);
+	}
+
+	if (Window) {
+		SDL_DestroyWindow(Window);
+	}
 }
 
 void Context::_calculateProjectionMatrix(float windowWidth,
                                          float windowHeight) {
+	_projectionWidth  = windowWidth;
+	_projectionHeight = windowHeight;
+
 	float left   = 0.0;
 	float right  = windowWidth;
 	float bottom = windowHeight;
@@ -79,14 +141,81 @@ void Context::_handleResize() {
 	Vk.HandleWindowResize(VkExtent2D{(uint32_t)w, (uint32_t)h});
 }
 
+VkPresentModeKHR Context::_toVkPresentMode(PresentMode presentMode) {
+	switch (presentMode) {
+	case PresentMode::FifoRelaxed:
+		return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+	case PresentMode::Mailbox:
+		return VK_PRESENT_MODE_MAILBOX_KHR;
+	case PresentMode::Immediate:
+		return VK_PRESENT_MODE_IMMEDIATE_KHR;
+	case PresentMode::Fifo:
+	default:
+		return VK_PRESENT_MODE_FIFO_KHR;
+	}
+}
+
+void Context::SetPresentMode(PresentMode presentMode,
+                             uint32_t minSwapchainImageCount) {
+	if (Vk.Headless) {
+		return;
+	}
+
+	vkDeviceWaitIdle(Vk.Device);
+
+	Vk.SetPresentMode(_toVkPresentMode(presentMode), minSwapchainImageCount);
+}
+
+PresentMode Context::GetPresentMode() const {
+	switch (Vk.PresentMode) {
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+		return PresentMode::FifoRelaxed;
+	case VK_PRESENT_MODE_MAILBOX_KHR:
+		return PresentMode::Mailbox;
+	case VK_PRESENT_MODE_IMMEDIATE_KHR:
+		return PresentMode::Immediate;
+	default:
+		return PresentMode::Fifo;
+	}
+}
+
 void Context::BeginDraw() {
-	// reset this frame's quad data
-	_quadData.clear();
+	FrameData &frame = Vk.GetCurrentFrame();
+
+	// wait until the GPU has finished rendering the last frame that used this
+	// FrameData (FramesInFlight frames ago). Timeout of 1 second
+	// The fence is only reset right before the frame is submitted again, so
+	// if anything throws in between, the next wait doesn't hang
+	VK_CHECK(
+	    vkWaitForFences(Vk.Device, 1, &frame.RenderFence, true, 1000000000));
+
+	// now that the GPU is done with this frame slot, whatever it retired can
+	// be destroyed
+	frame.DeletionQueue.flush(Vk);
+	_releaseRetiredTextures();
 
-	// wait until the GPU has finished rendering the last frame. Timeout of 1
-	// second
-	VK_CHECK(vkWaitForFences(Vk.Device, 1, &Vk.RenderFence, true, 1000000000));
-	VK_CHECK(vkResetFences(Vk.Device, 1, &Vk.RenderFence));
+	// refreshes VMA's memory budget
+	vmaSetCurrentFrameIndex(Vk.Allocator, FrameNumber);
+	_enforceTextureBudget();
+
+	// evicted textures drawn last frame, their uploads are submitted below
+	_reloadEvictedTextures();
+
+	// reset this frame's quad data
+	frame.QuadCount = 0;
+	frame.Quads.clear();
+	frame.QuadKeys.clear();
+
+	// kick off texture uploads requested since the last frame and find out
+	// which ones have finished, so DrawQuad knows which textures it can use
+	Vk.SubmitUploads();
+	Vk.PollUploads();
+
+	// a headless context always renders into its one offscreen image, there's
+	// nothing to acquire
+	if (Vk.Headless) {
+		_swapchainImageIndex = 0;
+	}
 
 	// If vkAcquireNextImageKHR returns VK_ERROR_OUT_OF_DATE_KHR, that means the
 	// swapchain needs to be recreated due to a window resize. But that's
@@ -98,27 +227,31 @@ void Context::BeginDraw() {
 	// still be necessary just so that second call happens)
 	// This is all you need to handle window resizing btw, which is sort of
 	// surprising.
-	while (true) {
+	while (!Vk.Headless) {
 		// Request image from the swapchain (1 sec timeout) and signal
-		// _presentSemaphore.
-		VkResult result = vkAcquireNextImageKHR(Vk.Device, Vk.Swapchain,
-		                                        1000000000, Vk.PresentSemaphore,
-		                                        nullptr, &_swapchainImageIndex);
+		// the frame's PresentSemaphore.
+		VkResult result = vkAcquireNextImageKHR(
+		    Vk.Device, Vk.Swapchain, 1000000000, frame.PresentSemaphore,
+		    nullptr, &_swapchainImageIndex);
 
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 			_handleResize();
 		} else {
+			// VK_SUBOPTIMAL_KHR still acquired an image
+			if (result != VK_SUBOPTIMAL_KHR) {
+				VK_CHECK(result);
+			}
 			break;
 		}
 	}
 
-	VK_CHECK(vkResetCommandBuffer(Vk.MainCommandBuffer, 0));
+	VK_CHECK(vkResetCommandBuffer(frame.MainCommandBuffer, 0));
 
 	// BEGIN COMMAND BUFFER
 	// --------------------
 
 	// naming it cmd for shorter writing
-	VkCommandBuffer cmd = Vk.MainCommandBuffer;
+	VkCommandBuffer cmd = frame.MainCommandBuffer;
 
 	// this command buffer will be used
 	// exactly once, so the usage_one_time flag is used
@@ -131,14 +264,47 @@ void Context::BeginDraw() {
 
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+	// blits can't be recorded inside a render pass
+	_recordPendingMipmaps(cmd);
+}
+
+void Context::EndDraw() {
+	_mergeDrawLists();
+
+	// off-screen quads are never uploaded or drawn
+	_culledQuadCount = Vk.CullQuads(_projectionWidth, _projectionHeight);
+
+	// put the quads in draw order, so each texture's quads end up next to
+	// each other (within a layer), and make them visible to the GPU
+	Vk.SortQuads();
+	Vk.FlushQuadsBuffer();
+
+	// textures created during the frame start uploading right away
+	Vk.SubmitUploads();
+	Vk.FlushTextureDescriptorWrites();
+
+	FrameData &frame = Vk.GetCurrentFrame();
+
+	// naming it cmd for shorter writing
+	VkCommandBuffer cmd = frame.MainCommandBuffer;
+
+	// copies and dispatches can't be recorded inside a render pass either
+	_uploadSprites(cmd);
+	if (!_spriteBatches.empty()) {
+		Vk.CullSprites(cmd, _spriteBatches, _projectionWidth,
+		               _projectionHeight);
+	}
+
 	// BEGIN RENDER PASS
 	// -----------------
 
-	// clear screen to black each frame
-	VkClearValue clearValue;
-	clearValue.color = {
+	// clear screen to black each frame, and the depth buffer (if there is
+	// one) to behind every quad
+	VkClearValue clearValues[2];
+	clearValues[0].color = {
 	    {0.0f, 0.0f, 0.0, 1.0f}
     };
+	clearValues[1].depthStencil = {0.0f, 0};
 
 	VkRenderPassBeginInfo rpInfo = {};
 	rpInfo.sType                 = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -151,33 +317,76 @@ void Context::BeginDraw() {
 	rpInfo.framebuffer         = Vk.Framebuffers[_swapchainImageIndex];
 
 	// connect clear values
-	rpInfo.clearValueCount = 1;
-	rpInfo.pClearValues    = &clearValue;
+	rpInfo.clearValueCount = Vk.UseDepthBuffer ? 2 : 1;
+	rpInfo.pClearValues    = clearValues;
 
 	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
-}
-
-void Context::EndDraw() {
-	// fill quads buffer with the quads that were rendered by the user in
-	// drawQuads
-	Vk.FillQuadsBuffer(_quadData);
 
 	// RENDERING COMMANDS
 	// ------------------
 
-	// naming it cmd for shorter writing
-	VkCommandBuffer cmd = Vk.MainCommandBuffer;
-
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, Vk.Pipeline);
+	// all the quad pipeline variants share one layout, so the descriptor
+	// sets and push constants stay bound when switching between them. Only
+	// set 0 changes between drawing sprites and quads
+	VkDescriptorSet descriptorSets[] = {frame.QuadsDescriptorSet,
+	                                    Vk.GlobalDescriptorSet};
 
 	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-	                        Vk.PipelineLayout, 0, 1, &Vk.GlobalDescriptorSet, 0,
+	                        Vk.PipelineLayout, 0, 2, descriptorSets, 0,
 	                        nullptr);
 
 	vkCmdPushConstants(cmd, Vk.PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
 	                   4 * 4 * 4, &_projectionMatrix);
 
-	vkCmdDraw(cmd, (uint32_t)(6 * _quadData.size()), 1, 0, 0);
+	Vk.BatchQuads(frame.QuadKeys, frame.QuadBatches);
+	_layoutLayers(frame.QuadBatches);
+
+	std::span<const QuadBatch> quadBatches = frame.QuadBatches;
+
+	auto drawSprites = [&](const LayerDraw &layer) {
+		if (layer.spriteBatchCount == 0) {
+			return;
+		}
+
+		VkDescriptorSet spritesSet = Vk.GetSpritesDescriptorSet();
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		                        Vk.PipelineLayout, 0, 1, &spritesSet, 0,
+		                        nullptr);
+		_drawSpriteBatches(cmd, layer.firstSpriteBatch,
+		                   layer.spriteBatchCount, layer.spriteDepthOffset);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		                        Vk.PipelineLayout, 0, 1,
+		                        &frame.QuadsDescriptorSet, 0, nullptr);
+	};
+
+	auto quadsOf = [&](const LayerDraw &layer) {
+		return quadBatches.subspan(layer.firstQuadBatch, layer.quadBatchCount);
+	};
+
+	// With a depth buffer the opaque batches go first, front to back, so
+	// every pixel they cover is only shaded once and everything behind them
+	// fails the depth test early. The rest follows in order, and only shows
+	// where it isn't behind an opaque quad. The sprites are always drawn in
+	// order, since only the GPU knows how many of them are left after
+	// culling, and their depths put them between the layers' quads
+	if (Vk.UseDepthBuffer) {
+		for (auto it = _layerDraws.rbegin(); it != _layerDraws.rend(); it++) {
+			_drawQuadBatches(cmd, quadsOf(*it), it->quadDepthOffset,
+			                 QuadPass::Opaque);
+		}
+
+		for (const LayerDraw &layer : _layerDraws) {
+			drawSprites(layer);
+			_drawQuadBatches(cmd, quadsOf(layer), layer.quadDepthOffset,
+			                 QuadPass::Blended);
+		}
+	} else {
+		for (const LayerDraw &layer : _layerDraws) {
+			drawSprites(layer);
+			_drawQuadBatches(cmd, quadsOf(layer), layer.quadDepthOffset,
+			                 QuadPass::All);
+		}
+	}
 
 	vkCmdEndRenderPass(cmd);
 	VK_CHECK(vkEndCommandBuffer(cmd));
@@ -185,38 +394,78 @@ void Context::EndDraw() {
 	// SUBMIT TO QUEUE
 	// ---------------
 
-	// wait on _presentSemaphore, as that semaphore is signaled when the
+	// wait on the transfer timeline, which makes the uploads this frame
+	// samples from (all already seen completed) visible to it, and on the
+	// frame's PresentSemaphore, as that semaphore is signaled when the
 	// swapchain is ready
-	// signal _renderSemaphore, to say that rendering has finished
+	// signal the frame's RenderSemaphore, to say that rendering has finished,
+	// and the frame timeline, which atlas uploads wait on
+
+	VkSemaphore waitSemaphores[] = {Vk.GetUploadTimeline(),
+	                                frame.PresentSemaphore};
+
+	VkPipelineStageFlags waitStages[] = {
+	    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+	    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+
+	// the value of the binary PresentSemaphore is ignored
+	uint64_t waitValues[] = {Vk.GetCompletedUploadValue(), 0};
+
+	VkSemaphore signalSemaphores[] = {Vk.GetFrameTimeline(),
+	                                  frame.RenderSemaphore};
+
+	uint64_t signalValues[] = {Vk.SubmitFrameValue(), 0};
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount   = 2;
+	timelineInfo.pWaitSemaphoreValues      = waitValues;
+	timelineInfo.signalSemaphoreValueCount = 2;
+	timelineInfo.pSignalSemaphoreValues    = signalValues;
 
 	VkSubmitInfo submit = {};
 	submit.sType        = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit.pNext        = nullptr;
+	submit.pNext        = &timelineInfo;
 
-	VkPipelineStageFlags waitStage =
-	    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	submit.pWaitDstStageMask = waitStages;
 
-	submit.pWaitDstStageMask = &waitStage;
+	submit.waitSemaphoreCount = 2;
+	submit.pWaitSemaphores    = waitSemaphores;
 
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores    = &Vk.PresentSemaphore;
+	submit.signalSemaphoreCount = 2;
+	submit.pSignalSemaphores    = signalSemaphores;
 
-	submit.signalSemaphoreCount = 1;
-	submit.pSignalSemaphores    = &Vk.RenderSemaphore;
+	// headless contexts don't acquire or present anything, so only the
+	// timelines need to be synchronized with
+	if (Vk.Headless) {
+		timelineInfo.waitSemaphoreValueCount   = 1;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		submit.waitSemaphoreCount              = 1;
+		submit.signalSemaphoreCount            = 1;
+	}
 
 	submit.commandBufferCount = 1;
 	submit.pCommandBuffers    = &cmd;
 
+	VK_CHECK(vkResetFences(Vk.Device, 1, &frame.RenderFence));
+
 	// submit command buffer to the queue and execute it.
-	//  _renderFence will now block until the graphic commands finish execution
-	VK_CHECK(vkQueueSubmit(Vk.GraphicsQueue, 1, &submit, Vk.RenderFence));
+	//  the frame's RenderFence will now block until the graphic commands finish
+	//  execution
+	VK_CHECK(vkQueueSubmit(Vk.GraphicsQueue, 1, &submit, frame.RenderFence));
+
+	if (Vk.Headless) {
+		Vk.AdvanceFrame();
+		FrameNumber++;
+		return;
+	}
 
 	// PRESENT TO SWAPCHAIN
 	// --------------------
 
 	// this will put the rendered image into the visible window.
-	// I'm waiting on _renderSemaphore for that, which is signaled when the
-	// drawing commands submitted to the queue have finished executing
+	// I'm waiting on the frame's RenderSemaphore for that, which is signaled
+	// when the drawing commands submitted to the queue have finished executing
 
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType            = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -225,49 +474,440 @@ void Context::EndDraw() {
 	presentInfo.pSwapchains    = &Vk.Swapchain;
 	presentInfo.swapchainCount = 1;
 
-	presentInfo.pWaitSemaphores    = &Vk.RenderSemaphore;
+	presentInfo.pWaitSemaphores    = &frame.RenderSemaphore;
 	presentInfo.waitSemaphoreCount = 1;
 
 	presentInfo.pImageIndices = &_swapchainImageIndex;
 
 	vkQueuePresentKHR(Vk.GraphicsQueue, &presentInfo);
 
+	Vk.AdvanceFrame();
 	FrameNumber++;
 }
 
+void Context::_drawQuadBatches(VkCommandBuffer cmd,
+                               std::span<const QuadBatch> batches,
+                               uint32_t depthOffset, QuadPass pass) {
+	if (pass == QuadPass::Opaque) {
+		for (auto it = batches.rbegin(); it != batches.rend(); it++) {
+			if (it->PipelineFlags & QUAD_PIPELINE_BLENDED) {
+				continue;
+			}
+
+			QuadDrawOrder order;
+			order.FirstQuad   = (int32_t)(it->FirstQuad + it->QuadCount - 1);
+			order.Step        = -1;
+			order.DepthOffset = depthOffset;
+			_drawQuadBatch(cmd, *it, order);
+		}
+
+		return;
+	}
+
+	for (const QuadBatch &batch : batches) {
+		if (pass == QuadPass::Blended &&
+		    !(batch.PipelineFlags & QUAD_PIPELINE_BLENDED)) {
+			continue;
+		}
+
+		QuadDrawOrder order;
+		order.FirstQuad   = (int32_t)batch.FirstQuad;
+		order.Step        = 1;
+		order.DepthOffset = depthOffset;
+		_drawQuadBatch(cmd, batch, order);
+	}
+}
+
+void Context::_drawSpriteBatches(VkCommandBuffer cmd, uint32_t first,
+                                 uint32_t count, uint32_t depthOffset) {
+	VkBuffer cullBatches =
+	    Vk.GetCurrentFrame().SpriteCullBatchesBuffer.VulkanBuffer;
+
+	for (uint32_t i = first; i < first + count; i++) {
+		const QuadBatch &batch = _spriteBatches[i];
+
+		QuadDrawOrder order;
+		order.FirstQuad   = (int32_t)batch.FirstQuad;
+		order.Step        = 1;
+		order.DepthOffset = depthOffset;
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		                  Vk.QuadPipelines[batch.PipelineFlags]);
+		vkCmdPushConstants(cmd, Vk.PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+		                   4 * 4 * 4, sizeof(QuadDrawOrder), &order);
+
+		// the instance count is however many sprites survived culling
+		vkCmdDrawIndirect(cmd, cullBatches, i * sizeof(SpriteCullBatch), 1,
+		                  sizeof(SpriteCullBatch));
+	}
+}
+
+void Context::_layoutLayers(std::span<const QuadBatch> quadBatches) {
+	_layerDraws.clear();
+
+	// Both lists of batches are sorted by layer. The depth of a quad is its
+	// index plus the depth offset (see quad.vert), so the offsets shift each
+	// layer's sprites and quads to the depths right after the layer before.
+	// They can wrap around, the sum in the shader wraps back
+	uint32_t depth  = 0;
+	uint32_t sprite = 0;
+	uint32_t quad   = 0;
+	while (sprite < _spriteBatches.size() || quad < quadBatches.size()) {
+		uint32_t layer = UINT32_MAX;
+		if (sprite < _spriteBatches.size()) {
+			layer = _spriteBatches[sprite].Layer;
+		}
+		if (quad < quadBatches.size()) {
+			layer = std::min(layer, quadBatches[quad].Layer);
+		}
+
+		LayerDraw draw        = {};
+		draw.firstSpriteBatch = sprite;
+		draw.firstQuadBatch   = quad;
+
+		if (sprite < _spriteBatches.size() &&
+		    _spriteBatches[sprite].Layer == layer) {
+			draw.spriteDepthOffset = depth - _spriteBatches[sprite].FirstQuad;
+		}
+		while (sprite < _spriteBatches.size() &&
+		       _spriteBatches[sprite].Layer == layer) {
+			depth += _spriteBatches[sprite].QuadCount;
+			sprite++;
+		}
+
+		if (quad < quadBatches.size() && quadBatches[quad].Layer == layer) {
+			draw.quadDepthOffset = depth - quadBatches[quad].FirstQuad;
+		}
+		while (quad < quadBatches.size() && quadBatches[quad].Layer == layer) {
+			depth += quadBatches[quad].QuadCount;
+			quad++;
+		}
+
+		draw.spriteBatchCount = sprite - draw.firstSpriteBatch;
+		draw.quadBatchCount   = quad - draw.firstQuadBatch;
+		_layerDraws.push_back(draw);
+	}
+
+	// past that the depths in quad.vert run out, and the quads beyond it
+	// would all share the furthest one and hide each other
+	if (Vk.UseDepthBuffer && depth > MAX_DEPTH_ORDERED_QUADS) {
+		throw std::runtime_error(
+		    "Too many quads and sprites in one frame to order them with the "
+		    "depth buffer, ContextOptions::depthBuffer has to be off");
+	}
+}
+
+void Context::_drawQuadBatch(VkCommandBuffer cmd, const QuadBatch &batch,
+                             QuadDrawOrder order) {
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+	                  Vk.QuadPipelines[batch.PipelineFlags]);
+	vkCmdPushConstants(cmd, Vk.PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+	                   4 * 4 * 4, sizeof(QuadDrawOrder), &order);
+
+	// one instance per quad, see quad.vert
+	vkCmdDraw(cmd, 4, batch.QuadCount, 0, 0);
+}
+
 void Context::DrawQuad(Quad quad, Color color,
                        std::optional<DrawQuadOptions> options) {
 	DrawQuadOptions opt =
 	    options.has_value() ? options.value() : DrawQuadOptions();
 
-	_quadData.push_back(QuadData(quad, color, opt));
+	Vk.PushQuad(QuadData(quad, color, opt), opt.layer);
 }
 
-void Context::DrawQuad(Quad quad, const char *textureName,
+void Context::DrawQuad(Quad quad, TextureHandle textureHandle,
                        std::optional<DrawQuadOptions> options) {
-	if (_textures.count(textureName) == 0) {
-		throw std::runtime_error("There is no texture with that name");
+	// skipped until the texture is uploaded (or loaded again after being
+	// evicted)
+	Texture *texture = _getDrawableTexture(textureHandle);
+	if (!texture) {
+		return;
+	}
+
+	texture->lastUsedFrame = FrameNumber;
+	if (texture->atlasPage != NO_ATLAS_PAGE) {
+		_atlasPages[texture->atlasPage].lastUsedFrame = FrameNumber;
 	}
 
 	DrawQuadOptions opt =
 	    options.has_value() ? options.value() : DrawQuadOptions();
 
-	_quadData.push_back(QuadData(quad, _textures[textureName].vkId, opt));
+	Vk.PushQuad(
+	    QuadData(quad, texture->vkId, texture->uvRect, opt, texture->opaque),
+	    opt.layer);
 }
 
-Vec2 Context::GetTextureDimensions(const char *name) {
-	if (_textures.count(name) == 0) {
+Texture *Context::_getDrawableTexture(TextureHandle handle) {
+	Texture *texture = _getTexture(handle);
+	if (!texture) {
+		throw std::runtime_error("Invalid texture handle");
+	}
+
+	// it (or its atlas page) was evicted, the next BeginDraw loads it again.
+	// If that failed recently (e.g. every texture slot was taken) it waits a
+	// while, until eviction might have made room
+	if (!texture->resident) {
+		if (!texture->reloadRequested &&
+		    FrameNumber >= texture->reloadRetryFrame) {
+			texture->reloadRequested = true;
+			_pendingReloads.push_back(handle);
+		}
+		return nullptr;
+	}
+
+	// the texture is still being uploaded
+	if (!Vk.IsUploadComplete(texture->uploadValue) ||
+	    texture->mipmapsPending) {
+		return nullptr;
+	}
+
+	return texture;
+}
+
+void Context::DrawQuad(Quad quad, const char *textureName,
+                       std::optional<DrawQuadOptions> options) {
+	DrawQuad(quad, GetTexture(textureName), options);
+}
+
+void Context::SubmitDrawList(const DrawList &list) {
+	_drawLists.push_back(&list);
+}
+
+void Context::_mergeDrawLists() {
+	// the order doesn't depend on which list was filled first
+	std::stable_sort(_drawLists.begin(), _drawLists.end(),
+	                 [](const DrawList *a, const DrawList *b) {
+		                 return a->Priority < b->Priority;
+	                 });
+
+	for (const DrawList *list : _drawLists) {
+		Vk.PushQuads(list->_quads, list->_keys);
+
+		if (list->_texturedQuads.empty()) {
+			continue;
+		}
+
+		// Looking a texture up can queue it to be loaded again and marks it as
+		// used, so that's done here, once for every texture of the list
+		_listTextures.clear();
+		for (TextureHandle handle : list->_textures) {
+			Texture *texture = _getDrawableTexture(handle);
+			if (!texture) {
+				_listTextures.push_back({false, 0, Quad(0, 0, 0, 0), false});
+				continue;
+			}
+
+			texture->lastUsedFrame = FrameNumber;
+			if (texture->atlasPage != NO_ATLAS_PAGE) {
+				_atlasPages[texture->atlasPage].lastUsedFrame = FrameNumber;
+			}
+
+			_listTextures.push_back(
+			    {true, texture->vkId, texture->uvRect, texture->opaque});
+		}
+
+		// Everything else only reads the list and the textures, so big
+		// lists are split into chunks that are built on the thread pool and
+		// this thread. The chunks have room for all their quads up front, so
+		// the jobs never allocate (or throw)
+		const size_t quadCount  = list->_texturedQuads.size();
+		const size_t chunkCount = std::clamp<size_t>(
+		    quadCount / MIN_TEXTURED_QUADS_PER_THREAD, 1,
+		    (size_t)_threadPool.GetThreadCount() + 1);
+		const size_t chunkSize = (quadCount + chunkCount - 1) / chunkCount;
+
+		if (_texturedQuadChunks.size() < chunkCount) {
+			_texturedQuadChunks.resize(chunkCount);
+		}
+
+		auto build = [&](size_t chunkIndex) {
+			TexturedQuadChunk &chunk = _texturedQuadChunks[chunkIndex];
+			chunk.quads.clear();
+			chunk.keys.clear();
+
+			size_t end = std::min(quadCount, (chunkIndex + 1) * chunkSize);
+			for (size_t i = chunkIndex * chunkSize; i < end; i++) {
+				const DrawList::TexturedQuad &quad = list->_texturedQuads[i];
+
+				const ListTexture &texture = _listTextures[quad.texture];
+
+				// skipped until the texture is uploaded (or loaded again
+				// after being evicted), like with DrawQuad
+				if (!texture.drawable) {
+					continue;
+				}
+
+				chunk.quads.push_back(QuadData(quad.quad, texture.vkId,
+				                               texture.uvRect, quad.options,
+				                               texture.opaque));
+				chunk.keys.push_back(
+				    quadSortKey(chunk.quads.back(), quad.options.layer));
+			}
+		};
+
+		for (size_t c = 0; c < chunkCount; c++) {
+			_texturedQuadChunks[c].quads.reserve(chunkSize);
+			_texturedQuadChunks[c].keys.reserve(chunkSize);
+		}
+
+		// the first chunk is built here while the pool builds the rest
+		{
+			JobGroup jobs(_threadPool);
+			for (size_t c = 1; c < chunkCount; c++) {
+				jobs.Push([&build, c]() { build(c); });
+			}
+			build(0);
+		}
+
+		// in order, so the quads keep the order they were recorded in
+		for (size_t c = 0; c < chunkCount; c++) {
+			Vk.PushQuads(_texturedQuadChunks[c].quads,
+			             _texturedQuadChunks[c].keys);
+		}
+	}
+
+	_drawLists.clear();
+}
+
+void Context::WaitForTextureUploads() {
+	Vk.WaitForUploads();
+}
+
+std::vector<uint8_t> Context::ReadPixels() {
+	if (FrameNumber == 0) {
+		throw std::runtime_error("Nothing has been rendered yet");
+	}
+
+	return Vk.ReadOffscreenImage();
+}
+
+TextureHandle Context::GetTexture(const char *name) {
+	auto it = _textureNames.find(name);
+	if (it == _textureNames.end()) {
 		throw std::runtime_error("There is no texture with that name");
 	}
 
-	return {(float)_textures[name].width, (float)_textures[name].height};
+	return it->second;
 }
 
-bool Context::CreateTextureFromFile(const char *name, const char *path) {
-	// early return if a texture with the given name
-	// already exists
-	if (_textures.count(name)) {
-		return false;
+Vec2 Context::GetTextureDimensions(TextureHandle textureHandle) {
+	Texture *texture = _getTexture(textureHandle);
+	if (!texture) {
+		throw std::runtime_error("Invalid texture handle");
+	}
+
+	return {(float)texture->width, (float)texture->height};
+}
+
+Vec2 Context::GetTextureDimensions(const char *name) {
+	return GetTextureDimensions(GetTexture(name));
+}
+
+void Context::DestroyTexture(TextureHandle textureHandle) {
+	if (!_getTexture(textureHandle)) {
+		throw std::runtime_error("Invalid texture handle");
+	}
+
+	TextureSlot &slot = _textureSlots[textureHandle.index];
+
+	if (slot.texture.spriteCount > 0) {
+		throw std::runtime_error("Texture is still used by sprites");
+	}
+
+	if (!slot.name.empty()) {
+		_textureNames.erase(slot.name);
+		slot.name.clear();
+	}
+
+	// invalidates every existing handle to this slot
+	slot.alive = false;
+	slot.generation++;
+
+	_retiredTextureSlots.push_back({FrameNumber, textureHandle.index});
+}
+
+void Context::_destroyTextureResources(const Texture &texture) {
+	// atlas entries don't own anything, their space in the page is reclaimed
+	// when the page is evicted. Evicted textures don't have anything left
+	if (texture.atlasPage != NO_ATLAS_PAGE || !texture.resident) {
+		return;
+	}
+
+	vkDestroyImageView(Vk.Device, texture.imageView, nullptr);
+	vmaDestroyImage(Vk.Allocator, texture.image, texture.allocation);
+
+	_freeDescriptorIndices.push_back(texture.vkId);
+	_textureMemoryUsage -= texture.memorySize;
+}
+
+void Context::_recordPendingMipmaps(VkCommandBuffer cmd) {
+	size_t remaining = 0;
+	for (TextureHandle handle : _pendingMipmaps) {
+		Texture *texture = _getTexture(handle);
+
+		// destroyed before it was ever drawn
+		if (!texture) {
+			continue;
+		}
+
+		if (!Vk.IsUploadComplete(texture->uploadValue)) {
+			_pendingMipmaps[remaining++] = handle;
+			continue;
+		}
+
+		VkExtent3D extent = {texture->width, texture->height, 1};
+		Vk.GenerateMipmaps(cmd, texture->image, extent, texture->mipLevels);
+		texture->mipmapsPending = false;
+	}
+
+	_pendingMipmaps.resize(remaining);
+}
+
+void Context::_releaseRetiredTextures() {
+	// A texture destroyed on FrameNumber D might be used by frame D (or D-1
+	// if it was destroyed between frames). By the time frame D+FramesInFlight
+	// begins, the fence wait in BeginDraw guarantees frame D has finished
+	const uint32_t framesInFlight = (uint32_t)Vk.Frames.size();
+
+	// the transfer queue might also still be writing to it, if it was
+	// destroyed right after being created
+	while (!_retiredTextureSlots.empty() &&
+	       _retiredTextureSlots.front().first + framesInFlight <= FrameNumber) {
+		uint32_t index = _retiredTextureSlots.front().second;
+		if (!Vk.IsUploadComplete(_textureSlots[index].texture.uploadValue)) {
+			break;
+		}
+
+		_retiredTextureSlots.pop_front();
+
+		_destroyTextureResources(_textureSlots[index].texture);
+		_freeTextureSlots.push_back(index);
+	}
+}
+
+std::optional<TextureHandle> Context::CreateTextureFromFile(const char *path) {
+	return CreateTextureFromFile(nullptr, path);
+}
+
+std::optional<TextureHandle>
+Context::CreateTextureFromFile(const char *name, const char *path) {
+	// early return if a texture with the given name already exists
+	if (name && _textureNames.count(name)) {
+		return std::nullopt;
+	}
+
+	// block compressed textures are uploaded as they are, without decoding
+	if (IsKtx2File(path)) {
+		std::optional<Ktx2Image> image = LoadKtx2File(path);
+		if (!image.has_value()) {
+			return std::nullopt;
+		}
+
+		return _createTexture(
+		    name, path, [&](TextureHandle, Texture &texture) {
+			    return _createCompressedTexture(texture, image.value());
+		    });
 	}
 
 	int width, height, channels;
@@ -276,174 +916,380 @@ bool Context::CreateTextureFromFile(const char *name, const char *path) {
 	    stbi_load(path, &width, &height, &channels, STBI_rgb_alpha);
 
 	if (!pixels) {
-		return false;
+		return std::nullopt;
 	}
 
-	void *pixel_ptr        = pixels;
-	VkDeviceSize imageSize = (uint64_t)(width * height * 4);
+	std::optional<TextureHandle> handle = _createTexture(
+	    name, path, [&](TextureHandle handle, Texture &texture) {
+		    return _placeTexture(handle, texture, pixels, (uint32_t)width,
+		                         (uint32_t)height);
+	    });
 
-	// temporary CPU buffer that will be used to upload
-	// to a real GPU buffer later on
-	Buffer stagingBuffer =
-	    Buffer(Vk.Allocator, (uint32_t)imageSize,
-	           VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	stbi_image_free(pixels);
 
-	// copy data to stagingBuffer and unmap its memory
-	memcpy(stagingBuffer.Data, pixel_ptr, static_cast<size_t>(imageSize));
-	vmaUnmapMemory(Vk.Allocator, stagingBuffer.Allocation);
+	return handle;
+}
 
-	// image data is now in stagingBuffer
-	stbi_image_free(pixels);
+std::vector<std::optional<TextureHandle>>
+Context::CreateTexturesFromFiles(std::span<const TextureFile> files) {
+	std::vector<std::optional<TextureHandle>> handles(files.size());
+
+	// names are checked up front, so files that would be rejected anyway
+	// aren't decoded
+	std::vector<size_t> toDecode;
+	std::unordered_set<std::string_view> batchNames;
+	for (size_t i = 0; i < files.size(); i++) {
+		const char *name = files[i].name;
+		if (name && (_textureNames.count(name) || batchNames.count(name))) {
+			continue;
+		}
 
-	VkExtent3D imageExtent;
-	imageExtent.width  = static_cast<uint32_t>(width);
-	imageExtent.height = static_cast<uint32_t>(height);
-	imageExtent.depth  = 1;
+		if (name) {
+			batchNames.insert(name);
+		}
+		toDecode.push_back(i);
+	}
+
+	std::vector<DecodedTexture> decoded(files.size());
+
+	// The thread pool decodes the files and hands them over through the
+	// finished queue. This thread creates the textures as they come in, so
+	// the uploads overlap with decoding the rest and only a few decoded
+	// images are in memory at once
+	std::mutex mutex;
+	std::condition_variable finishedCondition;
+	std::deque<size_t> finished;
+	std::atomic<size_t> nextToDecode = 0;
+
+	auto decode = [&]() {
+		while (true) {
+			size_t i = nextToDecode++;
+			if (i >= toDecode.size()) {
+				break;
+			}
+
+			size_t fileIndex = toDecode[i];
+			_decodeTextureFile(files[fileIndex].path, decoded[fileIndex]);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.push_back(fileIndex);
+			}
+			finishedCondition.notify_one();
+		}
+	};
+
+	// Waits for the workers when this function returns, or throws while
+	// they're still using its locals. They stop after the file they're
+	// decoding, and whatever was decoded but never turned into a texture is
+	// freed along with decoded
+	struct Workers {
+		JobGroup jobs;
+		std::atomic<size_t> &nextToDecode;
+		size_t fileCount;
+
+		~Workers() {
+			nextToDecode = fileCount;
+			jobs.Wait();
+		}
+	};
+
+	Workers workers{JobGroup(_threadPool), nextToDecode, toDecode.size()};
+
+	size_t workerCount = std::min<size_t>(
+	    std::max(_threadPool.GetThreadCount(), 1u), toDecode.size());
+	for (size_t i = 0; i < workerCount; i++) {
+		workers.jobs.Push(decode);
+	}
+
+	for (size_t done = 0; done < toDecode.size(); done++) {
+		size_t fileIndex;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			finishedCondition.wait(lock, [&]() { return !finished.empty(); });
+
+			fileIndex = finished.front();
+			finished.pop_front();
+		}
+
+		const TextureFile &file = files[fileIndex];
+		DecodedTexture &image   = decoded[fileIndex];
+
+		if (image.ktx2.has_value()) {
+			const Ktx2Image &ktx2 = image.ktx2.value();
+
+			handles[fileIndex] = _createTexture(
+			    file.name, file.path, [&](TextureHandle, Texture &texture) {
+				    return _createCompressedTexture(texture, ktx2);
+			    });
+
+			// the data has been copied into the staging ring already
+			image.ktx2.reset();
+		} else if (image.pixels) {
+			handles[fileIndex] = _createTexture(
+			    file.name, file.path,
+			    [&](TextureHandle handle, Texture &texture) {
+				    return _placeTexture(handle, texture, image.pixels,
+				                         image.width, image.height);
+			    });
+
+			stbi_image_free(image.pixels);
+			image.pixels = nullptr;
+		}
+	}
+
+	// the whole batch goes to the transfer queue in one submission (unless
+	// the staging ring filled up along the way and forced an earlier one)
+	Vk.SubmitUploads();
+
+	return handles;
+}
 
-	VkFormat imageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+std::optional<TextureHandle> Context::_createTexture(
+    const char *name, const char *path,
+    const std::function<bool(TextureHandle, Texture &)> &place) {
+	// reuse a free slot if there is one
+	uint32_t slotIndex;
+	if (!_freeTextureSlots.empty()) {
+		slotIndex = _freeTextureSlots.back();
+		_freeTextureSlots.pop_back();
+	} else {
+		slotIndex = (uint32_t)_textureSlots.size();
+		_textureSlots.push_back(TextureSlot());
+	}
 
-	VkImageCreateInfo imageCreateInfo = vk_init::imageCreateInfo(
-	    imageFormat,
-	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-	    imageExtent);
+	TextureSlot &slot    = _textureSlots[slotIndex];
+	TextureHandle handle = {slotIndex, slot.generation};
 
 	Texture texture;
-	texture.vkId   = (uint32_t)_textures.size();
-	texture.width  = (uint32_t)width;
-	texture.height = (uint32_t)height;
+	if (!place(handle, texture)) {
+		_freeTextureSlots.push_back(slotIndex);
+		return std::nullopt;
+	}
 
-	VmaAllocationCreateInfo imageAllocateInfo = {};
-	imageAllocateInfo.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+	slot.texture = texture;
+	slot.alive   = true;
+	slot.path    = path;
 
-	// allocate and create the image
-	VK_CHECK(vmaCreateImage(Vk.Allocator, &imageCreateInfo, &imageAllocateInfo,
-	                        &texture.image, &texture.allocation, nullptr));
+	if (name) {
+		slot.name           = name;
+		_textureNames[name] = handle;
+	}
+
+	return handle;
+}
+
+std::optional<uint32_t> Context::_allocateDescriptorIndex() {
+	if (!_freeDescriptorIndices.empty()) {
+		uint32_t index = _freeDescriptorIndices.back();
+		_freeDescriptorIndices.pop_back();
+		return index;
+	}
+
+	if (_descriptorIndexCount >= Vk.INITIAL_ARRAY_OF_TEXTURES_LENGTH) {
+		return std::nullopt;
+	}
+
+	return _descriptorIndexCount++;
+}
+
+// Whether every pixel of the tightly packed RGBA8 pixels has an alpha of 1
+static bool isOpaque(const uint8_t *pixels, uint32_t width, uint32_t height) {
+	const size_t size = (size_t)width * height * 4;
+	for (size_t i = 3; i < size; i += 4) {
+		if (pixels[i] != 0xFF) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Context::_placeTexture(TextureHandle handle, Texture &texture,
+                            const uint8_t *pixels, uint32_t width,
+                            uint32_t height) {
+	if (!_packIntoAtlas(handle, texture, pixels, width, height) &&
+	    !_createStandaloneTexture(handle, texture, pixels, width, height)) {
+		return false;
+	}
+
+	texture.opaque = isOpaque(pixels, width, height);
+	return true;
+}
 
-	Vk.ImmediateSubmit([&](VkCommandBuffer cmd) {
-		// TRANSFER IMAGE TO
-		// VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-		// ------------------------------------------------------
+bool Context::_createStandaloneTexture(TextureHandle handle, Texture &texture,
+                                       const uint8_t *pixels, uint32_t width,
+                                       uint32_t height) {
+	// a full chain goes down to 1x1
+	uint32_t mipLevels = 1;
+	if (_generateMipmaps) {
+		mipLevels = (uint32_t)std::bit_width(std::max(width, height));
+	}
 
-		VkImageSubresourceRange range;
-		range.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
-		range.baseMipLevel   = 0;
-		range.levelCount     = 1;
-		range.baseArrayLayer = 0;
-		range.layerCount     = 1;
+	VkImageUsageFlags imageUsage =
+	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	if (mipLevels > 1) {
+		imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
 
-		VkImageMemoryBarrier imageBarrier_toTransfer = {};
-		imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	if (!_createTextureImage(texture, VK_FORMAT_R8G8B8A8_SRGB, width, height,
+	                         mipLevels, imageUsage)) {
+		return false;
+	}
+
+	VkDeviceSize imageSize = (uint64_t)width * height * 4;
+	VkExtent3D imageExtent = {width, height, 1};
+
+	// the pixels are copied into the staging ring right away and uploaded on
+	// the transfer queue in the background. DrawQuad skips the texture until
+	// the upload is done
+	texture.uploadValue = Vk.UploadImage(texture.image, imageExtent, pixels,
+	                                     imageSize, mipLevels > 1);
+
+	if (mipLevels > 1) {
+		texture.mipmapsPending = true;
+		_pendingMipmaps.push_back(handle);
+	}
 
-		imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageBarrier_toTransfer.newLayout =
-		    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrier_toTransfer.image            = texture.image;
-		imageBarrier_toTransfer.subresourceRange = range;
+	return true;
+}
 
-		imageBarrier_toTransfer.srcAccessMask = 0;
-		imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+bool Context::_createCompressedTexture(Texture &texture,
+                                       const Ktx2Image &image) {
+	if (!Vk.SupportsTextureFormat(image.format)) {
+		return false;
+	}
 
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-		                     VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
-		                     nullptr, 1, &imageBarrier_toTransfer);
+	if (!_createTextureImage(
+	        texture, image.format, image.width, image.height,
+	        (uint32_t)image.levelOffsets.size(),
+	        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+		return false;
+	}
 
-		// COPY BUFFER TO IMAGE
-		// ------------------------------------------------------
+	// the mip levels come with the file
+	VkExtent3D imageExtent = {image.width, image.height, 1};
+	texture.uploadValue =
+	    Vk.UploadImageLevels(texture.image, imageExtent, image.data.data(),
+	                         image.data.size(), image.levelOffsets);
 
-		VkBufferImageCopy copyRegion = {};
-		copyRegion.bufferOffset      = 0;
-		copyRegion.bufferRowLength   = 0;
-		copyRegion.bufferImageHeight = 0;
+	// BC1 without alpha decodes every texel with an alpha of 1
+	texture.opaque = image.format == VK_FORMAT_BC1_RGB_UNORM_BLOCK ||
+	                 image.format == VK_FORMAT_BC1_RGB_SRGB_BLOCK;
 
-		copyRegion.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
-		copyRegion.imageSubresource.mipLevel       = 0;
-		copyRegion.imageSubresource.baseArrayLayer = 0;
-		copyRegion.imageSubresource.layerCount     = 1;
-		copyRegion.imageExtent                     = imageExtent;
+	return true;
+}
 
-		vkCmdCopyBufferToImage(cmd, stagingBuffer.VulkanBuffer, texture.image,
-		                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
-		                       &copyRegion);
+bool Context::_createTextureImage(Texture &texture, VkFormat format,
+                                  uint32_t width, uint32_t height,
+                                  uint32_t mipLevels,
+                                  VkImageUsageFlags usage) {
+	std::optional<uint32_t> descriptorIndex = _allocateDescriptorIndex();
+	if (!descriptorIndex.has_value()) {
+		return false;
+	}
 
-		// TRANSFER IMAGE TO
-		// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-		// ------------------------------------------------------
+	VkExtent3D imageExtent;
+	imageExtent.width  = width;
+	imageExtent.height = height;
+	imageExtent.depth  = 1;
 
-		VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
+	VkImageCreateInfo imageCreateInfo =
+	    vk_init::imageCreateInfo(format, usage, imageExtent, mipLevels);
 
-		imageBarrier_toReadable.oldLayout =
-		    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrier_toReadable.newLayout =
-		    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	uint32_t queueFamilies[2];
+	Vk.FillImageQueueFamilies(imageCreateInfo, queueFamilies);
 
-		imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	texture               = Texture();
+	texture.vkId          = descriptorIndex.value();
+	texture.width         = width;
+	texture.height        = height;
+	texture.mipLevels     = mipLevels;
+	texture.lastUsedFrame = FrameNumber;
+	texture.loadedFrame   = FrameNumber;
 
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-		                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
-		                     nullptr, 0, nullptr, 1, &imageBarrier_toReadable);
-	});
+	VmaAllocationCreateInfo imageAllocateInfo = {};
+	imageAllocateInfo.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
 
-	Vk.DeletionQueue.pushFunction([texture](const VkContext &ctx) {
-		vmaDestroyImage(ctx.Allocator, texture.image, texture.allocation);
-	});
+	// allocate and create the image
+	VmaAllocationInfo allocationInfo;
+	VK_CHECK(vmaCreateImage(Vk.Allocator, &imageCreateInfo, &imageAllocateInfo,
+	                        &texture.image, &texture.allocation,
+	                        &allocationInfo));
 
-	vmaDestroyBuffer(Vk.Allocator, stagingBuffer.VulkanBuffer,
-	                 stagingBuffer.Allocation);
+	texture.memorySize = allocationInfo.size;
+	_textureMemoryUsage += texture.memorySize;
 
 	VkImageViewCreateInfo imageViewInfo{};
 	imageViewInfo.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 	imageViewInfo.image    = texture.image;
 	imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	imageViewInfo.format   = imageFormat;
+	imageViewInfo.format   = format;
 	imageViewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
 	imageViewInfo.subresourceRange.baseMipLevel   = 0;
-	imageViewInfo.subresourceRange.levelCount     = 1;
+	imageViewInfo.subresourceRange.levelCount     = mipLevels;
 	imageViewInfo.subresourceRange.baseArrayLayer = 0;
 	imageViewInfo.subresourceRange.layerCount     = 1;
 
 	VK_CHECK(vkCreateImageView(Vk.Device, &imageViewInfo, nullptr,
 	                           &texture.imageView));
 
-	std::vector<VkDescriptorImageInfo> descriptorImageInfos;
-	descriptorImageInfos.resize(Vk.INITIAL_ARRAY_OF_TEXTURES_LENGTH);
+	// only this texture's own slot is written
+	VkDescriptorImageInfo descriptorImageInfo;
+	descriptorImageInfo.sampler     = Vk.GlobalSampler;
+	descriptorImageInfo.imageView   = texture.imageView;
+	descriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-	// Fill in all the descriptors with this same
-	// texture Only doing the minimum number of
-	// descriptors (_textures.size()+1), everything else
-	// can stay uninitialized
-	for (uint32_t i = 0; i < _textures.size() + 1; i++) {
-		descriptorImageInfos[i].sampler   = Vk.GlobalSampler;
-		descriptorImageInfos[i].imageView = texture.imageView;
-		descriptorImageInfos[i].imageLayout =
-		    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	}
+	Vk.QueueTextureDescriptorWrite(texture.vkId, descriptorImageInfo);
+
+	return true;
+}
+
+Context::DecodedTexture::~DecodedTexture() {
+	stbi_image_free(pixels);
+}
 
-	// Change all the previously created descriptors
-	// into their own image views
-	for (auto [name, t] : _textures) {
-		descriptorImageInfos[t.vkId].sampler   = Vk.GlobalSampler;
-		descriptorImageInfos[t.vkId].imageView = t.imageView;
-		descriptorImageInfos[t.vkId].imageLayout =
-		    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+void Context::_decodeTextureFile(const char *path, DecodedTexture &image) {
+	if (IsKtx2File(path)) {
+		image.ktx2 = LoadKtx2File(path);
+		return;
 	}
 
-	VkWriteDescriptorSet setWriteImage = {};
-	setWriteImage.sType                = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	setWriteImage.pNext                = nullptr;
-	setWriteImage.dstBinding           = 1;
-	setWriteImage.dstSet               = Vk.GlobalDescriptorSet;
-	setWriteImage.descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	setWriteImage.descriptorCount = (uint32_t)_textures.size() + 1;
-	setWriteImage.pImageInfo      = descriptorImageInfos.data();
+	int width = 0, height = 0, channels;
+	image.pixels = stbi_load(path, &width, &height, &channels, STBI_rgb_alpha);
+	image.width  = (uint32_t)width;
+	image.height = (uint32_t)height;
+}
+
+bool Context::_makeResident(uint32_t slotIndex,
+                            const DecodedTexture &image) {
+	TextureSlot &slot = _textureSlots[slotIndex];
+
+	// the texture is rebuilt from scratch, but the sprites using it are the
+	// same
+	const uint32_t spriteCount = slot.texture.spriteCount;
+
+	if (image.ktx2.has_value()) {
+		if (!_createCompressedTexture(slot.texture, image.ktx2.value())) {
+			return false;
+		}
 
-	vkUpdateDescriptorSets(Vk.Device, 1, &setWriteImage, 0, nullptr);
+		slot.texture.spriteCount = spriteCount;
+		return true;
+	}
 
-	Vk.DeletionQueue.pushFunction([texture](const VkContext &ctx) {
-		vkDestroyImageView(ctx.Device, texture.imageView, nullptr);
-	});
+	if (!image.pixels) {
+		return false;
+	}
 
-	_textures[name] = texture;
+	Texture texture;
+	if (!_placeTexture({slotIndex, slot.generation}, texture, image.pixels,
+	                   image.width, image.height)) {
+		return false;
+	}
+
+	slot.texture             = texture;
+	slot.texture.spriteCount = spriteCount;
 
 	return true;
-}
\ No newline at end of file
+}
@@ -5,10 +5,19 @@
 #include "util/geometry.h"
 #include "util/color.h"
 #include "util/quad_data.h"
+#include "util/context_options.h"
+#include "util/skyline_packer.h"
+#include "util/ktx2.h"
+#include "util/sprite.h"
+#include "util/draw_list.h"
+#include "util/thread_pool.h"
 #include "vk_context/vk_context.h"
 
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -17,32 +26,328 @@
 namespace azu {
 class Context {
 	float _projectionMatrix[4][4];
+	// the size the projection maps onto the window, which stays the same
+	// when the window is resized. Quads are culled against it
+	float _projectionWidth;
+	float _projectionHeight;
 
 	uint32_t _swapchainImageIndex; // is set at the beginning of beginDraw and
 	                               // used throughout the rendering loop
 
-	std::vector<QuadData> _quadData; // cleared at beginDraw and gets new
-	                                 // elements on every user call of drawQuad
+	// decodes texture files and merges big draw lists
+	ThreadPool _threadPool;
 
-	std::unordered_map<std::string, Texture>
-	    _textures; // cleared at beginDraw and gets new
-	               // elements on every user call of drawQuad
+	// Generational slot map of textures
+	struct TextureSlot {
+		Texture texture;
+		uint32_t generation = 0;
+		bool alive          = false;
+		std::string name; // empty if it doesn't have one
+		std::string path; // to load the texture again after an eviction
+	};
+
+	std::vector<TextureSlot> _textureSlots;
+	std::vector<uint32_t> _freeTextureSlots;
+
+	// Indices into the texture descriptor array. Only standalone textures
+	// and atlas pages take one, atlas entries use their page's
+	uint32_t _descriptorIndexCount = 0;
+	std::vector<uint32_t> _freeDescriptorIndices;
+
+	// destroyed textures whose slot might still be in use by frames in
+	// flight, paired with the FrameNumber they were destroyed on
+	std::deque<std::pair<uint32_t, uint32_t>> _retiredTextureSlots;
+
+	std::unordered_map<std::string, TextureHandle> _textureNames;
+
+	// TEXTURE ATLAS
+	// -------------
+
+	const uint32_t ATLAS_PAGE_SIZE = 2048;
+	// textures with either side bigger than this get their own image
+	const uint32_t ATLAS_MAX_ENTRY_SIZE = 256;
+	const uint32_t ATLAS_MAX_PAGES      = 4;
+
+	struct AtlasPage {
+		Texture texture;
+		SkylinePacker packer;
+		std::vector<TextureHandle> entries;
+		uint32_t lastUsedFrame = 0;
+	};
+
+	bool _useTextureAtlas;
+	std::vector<AtlasPage> _atlasPages;
+
+	// false if the texture doesn't fit into (or isn't allowed into) an atlas
+	// page, or no page has room and none can be evicted yet
+	bool _packIntoAtlas(TextureHandle handle, Texture &texture,
+	                    const uint8_t *pixels, uint32_t width,
+	                    uint32_t height);
+	std::optional<uint32_t> _createAtlasPage();
+	void _evictAtlasPage(uint32_t pageIndex);
+
+	Texture *_getTexture(TextureHandle handle) {
+		if (handle.index >= _textureSlots.size()) {
+			return nullptr;
+		}
+
+		TextureSlot &slot = _textureSlots[handle.index];
+		if (!slot.alive || slot.generation != handle.generation) {
+			return nullptr;
+		}
+
+		return &slot.texture;
+	}
+
+	std::optional<uint32_t> _allocateDescriptorIndex();
+
+	// Allocates a texture slot, lets place fill in the texture and registers
+	// it under name
+	std::optional<TextureHandle>
+	_createTexture(const char *name, const char *path,
+	               const std::function<bool(TextureHandle, Texture &)> &place);
+
+	// Fills texture with either an atlas entry or an image of its own, and
+	// starts uploading the pixels (tightly packed RGBA8). False if there's no
+	// descriptor index left for it
+	bool _placeTexture(TextureHandle handle, Texture &texture,
+	                   const uint8_t *pixels, uint32_t width, uint32_t height);
+	bool _createStandaloneTexture(TextureHandle handle, Texture &texture,
+	                              const uint8_t *pixels, uint32_t width,
+	                              uint32_t height);
+	// False if the GPU doesn't support the image's format
+	bool _createCompressedTexture(Texture &texture, const Ktx2Image &image);
+	// Creates the image, its view and its descriptor, without uploading
+	// anything
+	bool _createTextureImage(Texture &texture, VkFormat format, uint32_t width,
+	                         uint32_t height, uint32_t mipLevels,
+	                         VkImageUsageFlags usage);
+
+	// A texture file decoded on the thread pool. Either pixels (tightly
+	// packed RGBA8, freed along with the struct) or ktx2 is set, unless the
+	// file couldn't be loaded
+	struct DecodedTexture {
+		uint8_t *pixels = nullptr;
+		uint32_t width  = 0;
+		uint32_t height = 0;
+		std::optional<Ktx2Image> ktx2;
+
+		DecodedTexture() = default;
+		DecodedTexture(const DecodedTexture &)            = delete;
+		DecodedTexture &operator=(const DecodedTexture &) = delete;
+		~DecodedTexture();
+	};
+
+	// Only touches image, so it can run on any thread
+	static void _decodeTextureFile(const char *path, DecodedTexture &image);
+
+	// Recreates an evicted texture from its decoded file. False if the file
+	// couldn't be loaded or there's no room for it, and it stays evicted
+	bool _makeResident(uint32_t slotIndex, const DecodedTexture &image);
+
+	bool _generateMipmaps;
+	// textures whose mip chain still has to be generated
+	std::vector<TextureHandle> _pendingMipmaps;
+
+	// Records mip generation for the pending textures whose upload has
+	// completed
+	void _recordPendingMipmaps(VkCommandBuffer cmd);
+
+	// RESIDENCY
+	// ---------
+
+	uint64_t _textureMemoryBudget;
+	uint64_t _textureMemoryUsage = 0;
+
+	// textures have to go this many frames without being drawn (or since
+	// they were loaded) before they can be evicted, on top of the frames in
+	// flight
+	const uint32_t EVICTION_IDLE_FRAMES = 120;
+
+	// an evicted texture that failed to load again isn't tried again for
+	// this many frames, doubled with every failure in a row, at most
+	// RELOAD_MAX_DOUBLINGS times
+	const uint32_t RELOAD_RETRY_FRAMES  = 60;
+	const uint32_t RELOAD_MAX_DOUBLINGS = 4;
+
+	// evicted textures that were drawn since the last BeginDraw
+	std::vector<TextureHandle> _pendingReloads;
+
+	// Evicts the least recently drawn textures while over budget
+	void _enforceTextureBudget();
+	void _evictTexture(Texture &texture);
+	// Loads the textures in _pendingReloads from their files again, decoding
+	// them on the thread pool
+	void _reloadEvictedTextures();
+
+	// The texture if it can be drawn right now. If it was evicted it's
+	// queued to be loaded again by the next BeginDraw, and nothing is
+	// returned until it's back. Throws if the handle is invalid
+	Texture *_getDrawableTexture(TextureHandle handle);
+
+	void _destroyTextureResources(const Texture &texture);
+	void _releaseRetiredTextures();
+
+	// RETAINED SPRITES
+	// ----------------
+
+	const uint32_t NO_SPRITE_POSITION = UINT32_MAX;
+
+	struct SpriteSlot {
+		uint32_t generation = 0;
+		bool alive          = false;
+
+		// what the sprite was created or last updated with
+		Quad quad     = Quad(0, 0, 0, 0);
+		Color color   = Color::white();
+		std::optional<TextureHandle> texture; // kept resident while in use
+		DrawQuadOptions options;
+
+		// what's uploaded, which needs the texture to be ready to be drawn
+		std::optional<QuadData> data;
+		bool waiting = false; // for the texture, in _waitingSprites
+
+		uint64_t key      = 0; // quadSortKey of data
+		uint32_t position = NO_SPRITE_POSITION; // in the sprites buffer
+	};
+
+	std::vector<SpriteSlot> _spriteSlots;
+	std::vector<uint32_t> _freeSpriteSlots;
+	std::vector<uint32_t> _waitingSprites;
+
+	// The sprites buffer holds the sprites in the order of their keys, the
+	// same way the quads buffer does. Sprites being created or changing keys
+	// puts everything in order again and uploads all of it, other changes
+	// only upload the positions that changed
+	std::vector<uint64_t> _spriteOrder; // key and slot index per position
+	std::vector<uint64_t> _spriteOrderScratch;
+	std::vector<QuadBatch> _spriteBatches;
+	std::vector<uint32_t> _dirtySpritePositions;
+	bool _spritesNeedSorting = false;
+
+	SpriteSlot *_getSprite(SpriteHandle handle);
+	SpriteHandle _createSprite(Quad quad, Color color,
+	                           std::optional<TextureHandle> texture,
+	                           std::optional<DrawQuadOptions> options);
+	void _setSprite(uint32_t slotIndex, Quad quad, Color color,
+	                std::optional<TextureHandle> texture,
+	                std::optional<DrawQuadOptions> options);
+	void _unpinSpriteTexture(std::optional<TextureHandle> handle);
+	// Rebuilds what's uploaded for the sprite, or waits for its texture
+	void _refreshSprite(uint32_t slotIndex);
+	// Records the copies of whatever changed into the sprites buffer
+	void _uploadSprites(VkCommandBuffer cmd);
+
+	// DRAWING
+	// -------
+
+	uint32_t _culledQuadCount = 0;
+
+	// submitted this frame, merged by EndDraw
+	std::vector<const DrawList *> _drawLists;
+	void _mergeDrawLists();
+
+	// What _mergeDrawLists found out about each texture of a list
+	struct ListTexture {
+		bool drawable;
+		uint32_t vkId;
+		Quad uvRect;
+		bool opaque;
+	};
+	std::vector<ListTexture> _listTextures;
+
+	// Textured quads of a list that are turned into QuadData and keys by the
+	// same thread, see _mergeDrawLists
+	struct TexturedQuadChunk {
+		std::vector<QuadData> quads;
+		std::vector<uint64_t> keys;
+	};
+	std::vector<TexturedQuadChunk> _texturedQuadChunks;
+
+	// lists with fewer textured quads than this per CPU core are merged on
+	// the main thread alone
+	const size_t MIN_TEXTURED_QUADS_PER_THREAD = 8192;
+
+	// With a depth buffer the opaque batches are drawn in their own pass
+	// before the blended ones
+	enum class QuadPass {
+		All,
+		Opaque, // front to back
+		Blended
+	};
+
+	// Draws the batches that belong to pass from the quads buffer bound to
+	// set 0
+	void _drawQuadBatches(VkCommandBuffer cmd,
+	                      std::span<const QuadBatch> batches,
+	                      uint32_t depthOffset, QuadPass pass);
+	// Binds the batch's pipeline variant and draws its quads in order
+	void _drawQuadBatch(VkCommandBuffer cmd, const QuadBatch &batch,
+	                    QuadDrawOrder order);
+	// Draws count sprite batches from first with the draws written by
+	// VkContext::CullSprites
+	void _drawSpriteBatches(VkCommandBuffer cmd, uint32_t first,
+	                        uint32_t count, uint32_t depthOffset);
+
+	// The sprite and quad batches of one layer, and the depth offsets that
+	// put them in front of every lower layer. Within a layer the sprites are
+	// behind the quads
+	struct LayerDraw {
+		uint32_t firstSpriteBatch;
+		uint32_t spriteBatchCount;
+		uint32_t spriteDepthOffset;
+		uint32_t firstQuadBatch;
+		uint32_t quadBatchCount;
+		uint32_t quadDepthOffset;
+	};
+
+	std::vector<LayerDraw> _layerDraws; // filled by _layoutLayers
+
+	// quad.vert steps the depth by 2^-23 per quad, so with a depth buffer
+	// no more quads and sprites than this can be drawn in one frame
+	const uint32_t MAX_DEPTH_ORDERED_QUADS = 1u << 23;
+
+	// Goes through the sprite and quad batches layer by layer and gives
+	// them consecutive depths in that order. Throws if they don't all fit
+	// into the depth buffer's range
+	void _layoutLayers(std::span<const QuadBatch> quadBatches);
 
 	void _calculateProjectionMatrix(float windowWidth, float windowHeight);
 
 	void _handleResize();
 
+	static VkPresentModeKHR _toVkPresentMode(PresentMode presentMode);
+
   public:
 	uint32_t FrameNumber = 0;
 
-	SDL_Window *Window;
+	SDL_Window *Window; // nullptr for headless contexts
 	VkContext Vk;
 
-	Context(std::string_view title, uint32_t width, uint32_t height);
+	Context(std::string_view title, uint32_t width, uint32_t height,
+	        ContextOptions options = ContextOptions());
+
+	// Recreates the swapchain with a new present mode, falling back the same
+	// way as ContextOptions::presentMode does
+	void SetPresentMode(PresentMode presentMode,
+	                    uint32_t minSwapchainImageCount = 0);
+
+	// The present mode that's actually in use, which might be a fallback
+	PresentMode GetPresentMode() const;
+
+	// Only for headless contexts: returns the last rendered frame as tightly
+	// packed RGBA8 pixels, row by row from the top
+	std::vector<uint8_t> ReadPixels();
 
 	void BeginDraw();
 	void EndDraw();
 
+	// How many of the quads drawn in the last frame were skipped because
+	// they were entirely outside of the window
+	uint32_t GetCulledQuadCount() const {
+		return _culledQuadCount;
+	}
+
 	// Just a wrapper over calling BeginDraw and EndDraw
 	template <typename F> void Draw(F f) {
 		BeginDraw();
@@ -52,11 +357,71 @@ class Context {
 
 	void DrawQuad(Quad quad, Color color,
 	              std::optional<DrawQuadOptions> options = std::nullopt);
+	void DrawQuad(Quad quad, TextureHandle texture,
+	              std::optional<DrawQuadOptions> options = std::nullopt);
+	// Slower than using a TextureHandle, as the name has to be looked up
 	void DrawQuad(Quad quad, const char *textureName,
 	              std::optional<DrawQuadOptions> options = std::nullopt);
 
-	bool CreateTextureFromFile(const char *name, const char *path);
+	// Draws the quads recorded into the list this frame. The list isn't
+	// copied until EndDraw, so it has to stay alive and unchanged until then,
+	// and every thread filling it has to be done before it's submitted
+	void SubmitDrawList(const DrawList &list);
+
+	// The texture is uploaded in the background, DrawQuad skips it until the
+	// upload has finished (usually a frame or two later). KTX2 files with
+	// BC1, BC3 or BC7 data (and no supercompression) are uploaded as they are,
+	// mip levels included, if the GPU supports the format. Small textures are
+	// packed into a shared atlas page unless ContextOptions::useTextureAtlas
+	// is off. Returns nothing if the file couldn't be loaded, the name is
+	// taken or there are no texture slots left
+	std::optional<TextureHandle> CreateTextureFromFile(const char *name,
+	                                                   const char *path);
+	// Same, but without a name, so it can only be used through the handle
+	std::optional<TextureHandle> CreateTextureFromFile(const char *path);
+	// Same as calling CreateTextureFromFile for every file, but the files are
+	// decoded on all CPU cores and uploaded in one batch. The results are in
+	// the same order as the files. If a name appears more than once only the
+	// first file is loaded, the others are skipped and get nothing
+	std::vector<std::optional<TextureHandle>>
+	CreateTexturesFromFiles(std::span<const TextureFile> files);
+
+	// Throws if there's no texture with that name
+	TextureHandle GetTexture(const char *name);
+
+	// The handle (and the name, if it had one) stops being valid right away,
+	// the GPU resources are freed once no frame in flight can use them
+	void DestroyTexture(TextureHandle texture);
+
+	// Blocks until every texture created so far can be drawn
+	void WaitForTextureUploads();
+
+	// Retained sprites are quads that stay on the GPU until they're
+	// destroyed, so drawing them costs next to nothing on frames where they
+	// don't change. They're drawn every frame, sorted the same way as quads
+	// from DrawQuad, and interleaved with them by layer (within a layer the
+	// sprites are behind the quads). Textured sprites show up once their
+	// texture has been uploaded, and the texture can't be evicted or
+	// destroyed while they use it. The ones outside the window are culled by
+	// the GPU, so there's no per sprite work on the CPU
+	SpriteHandle
+	CreateSprite(Quad quad, Color color,
+	             std::optional<DrawQuadOptions> options = std::nullopt);
+	SpriteHandle
+	CreateSprite(Quad quad, TextureHandle texture,
+	             std::optional<DrawQuadOptions> options = std::nullopt);
+
+	// Only the sprite is uploaded again if its layer, texture and pipeline
+	// variant stay the same (e.g. when it's moved). Otherwise every sprite
+	// is put in order again
+	void UpdateSprite(SpriteHandle sprite, Quad quad, Color color,
+	                  std::optional<DrawQuadOptions> options = std::nullopt);
+	void UpdateSprite(SpriteHandle sprite, Quad quad, TextureHandle texture,
+	                  std::optional<DrawQuadOptions> options = std::nullopt);
+
+	void DestroySprite(SpriteHandle sprite);
 
+	Vec2 GetTextureDimensions(TextureHandle texture);
 	Vec2 GetTextureDimensions(const char *name);
 
 	~Context();
@@ -40,7 +40,7 @@ int main() {
 			    Quad(screenWidth / 2 - width / 2, screenHeight / 2 - height / 2,
 			         width, height),
 			    Color::white(),
-			    DrawQuadOptions(QuadCornerValues(0.0, 0.5, 0.5, 0.0), 1.0));
+			    DrawQuadOptions(QuadCornerValues(0.0, 0.5, 0.5, 0.0), 1.0, 1));
 		});
 	}
 
@@ -0,0 +1,124 @@
+#include "azu.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace azu;
+
+void Context::_enforceTextureBudget() {
+	uint64_t toFree = Vk.GetDeviceMemoryOverBudget();
+	if (_textureMemoryBudget > 0 &&
+	    _textureMemoryUsage > _textureMemoryBudget) {
+		toFree = std::max(toFree, _textureMemoryUsage - _textureMemoryBudget);
+	}
+
+	if (toFree == 0) {
+		return;
+	}
+
+	// Only textures with an image of their own are evicted (atlas pages are
+	// already recycled by the atlas). A texture last drawn on frame F could
+	// be destroyed once frame F + FramesInFlight begins, the same way retired
+	// textures are, but a texture that's only skipped for a few frames would
+	// then be loaded again right away. So it has to stay idle for a while
+	// longer, and a texture that was just loaded again is kept for as long
+	const uint32_t idleFrames =
+	    (uint32_t)Vk.Frames.size() + EVICTION_IDLE_FRAMES;
+
+	std::vector<uint32_t> candidates;
+	uint64_t evictable = 0;
+	for (uint32_t i = 0; i < _textureSlots.size(); i++) {
+		const TextureSlot &slot = _textureSlots[i];
+		const Texture &texture  = slot.texture;
+
+		bool idle = texture.lastUsedFrame + idleFrames <= FrameNumber &&
+		            texture.loadedFrame + idleFrames <= FrameNumber;
+
+		if (slot.alive && texture.resident &&
+		    texture.atlasPage == NO_ATLAS_PAGE && texture.spriteCount == 0 &&
+		    idle &&
+		    Vk.IsUploadComplete(texture.uploadValue) &&
+		    !texture.mipmapsPending) {
+			candidates.push_back(i);
+			evictable += texture.memorySize;
+		}
+	}
+
+	// The device budget also counts buffers and everything else that isn't a
+	// texture. If evicting every candidate still wouldn't get under it,
+	// eviction can't fix the pressure, and evicting anyway would only make
+	// the textures load again
+	if (evictable < toFree) {
+		return;
+	}
+
+	// least recently drawn first
+	std::sort(candidates.begin(), candidates.end(),
+	          [&](uint32_t a, uint32_t b) {
+		          return _textureSlots[a].texture.lastUsedFrame <
+		                 _textureSlots[b].texture.lastUsedFrame;
+	          });
+
+	uint64_t freed = 0;
+	for (uint32_t index : candidates) {
+		if (freed >= toFree) {
+			break;
+		}
+
+		Texture &texture = _textureSlots[index].texture;
+		freed += texture.memorySize;
+		_evictTexture(texture);
+	}
+}
+
+void Context::_evictTexture(Texture &texture) {
+	// the handle and name stay valid, the texture is loaded from its file
+	// again after the next time it's drawn
+	_destroyTextureResources(texture);
+	texture.resident = false;
+}
+
+void Context::_reloadEvictedTextures() {
+	if (_pendingReloads.empty()) {
+		return;
+	}
+
+	std::vector<TextureHandle> reloads;
+	reloads.swap(_pendingReloads);
+
+	// textures destroyed since they were drawn are skipped
+	std::vector<uint32_t> slots;
+	for (TextureHandle handle : reloads) {
+		if (Texture *texture = _getTexture(handle)) {
+			texture->reloadRequested = false;
+			slots.push_back(handle.index);
+		}
+	}
+
+	// the files are decoded on the thread pool all at once, and turned into
+	// textures here once they all are
+	std::vector<DecodedTexture> decoded(slots.size());
+	{
+		JobGroup jobs(_threadPool);
+		for (size_t i = 0; i < slots.size(); i++) {
+			const char *path      = _textureSlots[slots[i]].path.c_str();
+			DecodedTexture &image = decoded[i];
+			jobs.Push([path, &image]() { _decodeTextureFile(path, image); });
+		}
+	}
+
+	for (size_t i = 0; i < slots.size(); i++) {
+		if (_makeResident(slots[i], decoded[i])) {
+			continue;
+		}
+
+		// it most likely fails again right away, so it's given some time
+		// before it's tried again, which gets longer while it keeps failing
+		Texture &texture   = _textureSlots[slots[i]].texture;
+		uint32_t doublings = std::min(texture.reloadFailures,
+		                              RELOAD_MAX_DOUBLINGS);
+		texture.reloadRetryFrame =
+		    FrameNumber + (RELOAD_RETRY_FRAMES << doublings);
+		texture.reloadFailures++;
+	}
+}
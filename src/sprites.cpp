@@ -0,0 +1,282 @@
+#include "azu.h"
+
+#include "util/radix_sort.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using namespace azu;
+
+SpriteHandle Context::CreateSprite(Quad quad, Color color,
+                                   std::optional<DrawQuadOptions> options) {
+	return _createSprite(quad, color, std::nullopt, options);
+}
+
+SpriteHandle Context::CreateSprite(Quad quad, TextureHandle texture,
+                                   std::optional<DrawQuadOptions> options) {
+	if (!_getTexture(texture)) {
+		throw std::runtime_error("Invalid texture handle");
+	}
+
+	return _createSprite(quad, Color::white(), texture, options);
+}
+
+void Context::UpdateSprite(SpriteHandle sprite, Quad quad, Color color,
+                           std::optional<DrawQuadOptions> options) {
+	if (!_getSprite(sprite)) {
+		throw std::runtime_error("Invalid sprite handle");
+	}
+
+	_setSprite(sprite.index, quad, color, std::nullopt, options);
+}
+
+void Context::UpdateSprite(SpriteHandle sprite, Quad quad,
+                           TextureHandle texture,
+                           std::optional<DrawQuadOptions> options) {
+	if (!_getSprite(sprite)) {
+		throw std::runtime_error("Invalid sprite handle");
+	}
+
+	if (!_getTexture(texture)) {
+		throw std::runtime_error("Invalid texture handle");
+	}
+
+	_setSprite(sprite.index, quad, Color::white(), texture, options);
+}
+
+void Context::DestroySprite(SpriteHandle sprite) {
+	SpriteSlot *slot = _getSprite(sprite);
+	if (!slot) {
+		throw std::runtime_error("Invalid sprite handle");
+	}
+
+	_unpinSpriteTexture(slot->texture);
+
+	// zeroed by the next upload, and left out of the next sort
+	if (slot->position != NO_SPRITE_POSITION) {
+		_dirtySpritePositions.push_back(slot->position);
+		slot->position = NO_SPRITE_POSITION;
+	}
+
+	slot->alive = false;
+	slot->generation++;
+	slot->texture.reset();
+	slot->data.reset();
+	slot->waiting = false;
+
+	_freeSpriteSlots.push_back(sprite.index);
+}
+
+Context::SpriteSlot *Context::_getSprite(SpriteHandle handle) {
+	if (handle.index >= _spriteSlots.size()) {
+		return nullptr;
+	}
+
+	SpriteSlot &slot = _spriteSlots[handle.index];
+	if (!slot.alive || slot.generation != handle.generation) {
+		return nullptr;
+	}
+
+	return &slot;
+}
+
+SpriteHandle Context::_createSprite(Quad quad, Color color,
+                                    std::optional<TextureHandle> texture,
+                                    std::optional<DrawQuadOptions> options) {
+	uint32_t slotIndex;
+	if (!_freeSpriteSlots.empty()) {
+		slotIndex = _freeSpriteSlots.back();
+		_freeSpriteSlots.pop_back();
+	} else {
+		// the slot index is the sequence part of the sprite's sort key
+		if (_spriteSlots.size() >> QUAD_KEY_SEQUENCE_BITS) {
+			throw std::runtime_error("Too many sprites");
+		}
+
+		slotIndex = (uint32_t)_spriteSlots.size();
+		_spriteSlots.emplace_back();
+	}
+
+	_spriteSlots[slotIndex].alive = true;
+	_setSprite(slotIndex, quad, color, texture, options);
+
+	return SpriteHandle{slotIndex, _spriteSlots[slotIndex].generation};
+}
+
+void Context::_setSprite(uint32_t slotIndex, Quad quad, Color color,
+                         std::optional<TextureHandle> texture,
+                         std::optional<DrawQuadOptions> options) {
+	SpriteSlot &slot = _spriteSlots[slotIndex];
+
+	// pinned before the old one is unpinned, in case they're the same
+	if (texture.has_value()) {
+		_getTexture(texture.value())->spriteCount++;
+	}
+	_unpinSpriteTexture(slot.texture);
+
+	slot.quad    = quad;
+	slot.color   = color;
+	slot.texture = texture;
+	slot.options = options.has_value() ? options.value() : DrawQuadOptions();
+
+	_refreshSprite(slotIndex);
+}
+
+void Context::_unpinSpriteTexture(std::optional<TextureHandle> handle) {
+	if (!handle.has_value()) {
+		return;
+	}
+
+	// DestroyTexture refuses to destroy pinned textures, so it's still there
+	Texture *texture = _getTexture(handle.value());
+	texture->spriteCount--;
+
+	// frames in flight might still be drawing the sprite, so the texture
+	// only becomes evictable once they're done, like any drawn texture
+	texture->lastUsedFrame = FrameNumber;
+	if (texture->atlasPage != NO_ATLAS_PAGE) {
+		_atlasPages[texture->atlasPage].lastUsedFrame = FrameNumber;
+	}
+}
+
+void Context::_refreshSprite(uint32_t slotIndex) {
+	SpriteSlot &slot = _spriteSlots[slotIndex];
+
+	std::optional<QuadData> data;
+	if (!slot.texture.has_value()) {
+		data = QuadData(slot.quad, slot.color, slot.options);
+	} else if (Texture *t = _getDrawableTexture(slot.texture.value())) {
+		data = QuadData(slot.quad, t->vkId, t->uvRect, slot.options,
+		                t->opaque);
+	}
+
+	// hidden until its texture can be drawn, checked again every frame
+	if (!data.has_value()) {
+		slot.data.reset();
+		if (slot.position != NO_SPRITE_POSITION) {
+			_dirtySpritePositions.push_back(slot.position);
+		}
+
+		if (!slot.waiting) {
+			slot.waiting = true;
+			_waitingSprites.push_back(slotIndex);
+		}
+
+		return;
+	}
+
+	uint64_t key = quadSortKey(data.value(), slot.options.layer);
+
+	// the sprite keeps its position (and batch) as long as its key doesn't
+	// change, and only has to be uploaded again
+	if (slot.position != NO_SPRITE_POSITION && slot.data.has_value() &&
+	    key == slot.key) {
+		_dirtySpritePositions.push_back(slot.position);
+	} else {
+		_spritesNeedSorting = true;
+	}
+
+	slot.data = data;
+	slot.key  = key;
+}
+
+void Context::_uploadSprites(VkCommandBuffer cmd) {
+	// sprites whose texture finished uploading show up this frame
+	std::vector<uint32_t> waiting;
+	std::swap(waiting, _waitingSprites);
+	for (uint32_t slotIndex : waiting) {
+		SpriteSlot &slot = _spriteSlots[slotIndex];
+		if (slot.alive && slot.waiting) {
+			slot.waiting = false;
+			_refreshSprite(slotIndex);
+		}
+	}
+
+	// (first position, count) of every range of the buffer to upload
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+
+	if (_spritesNeedSorting) {
+		_spritesNeedSorting = false;
+
+		_spriteOrder.clear();
+		for (uint32_t i = 0; i < _spriteSlots.size(); i++) {
+			SpriteSlot &slot = _spriteSlots[i];
+			slot.position    = NO_SPRITE_POSITION;
+
+			if (slot.alive && slot.data.has_value()) {
+				_spriteOrder.push_back(slot.key | i);
+			}
+		}
+
+		// the slot indices are unique, only the key bits need sorting
+		RadixSort(_spriteOrder, _spriteOrderScratch, QUAD_KEY_SEQUENCE_BITS);
+
+		const uint64_t slotMask = (1ull << QUAD_KEY_SEQUENCE_BITS) - 1;
+		for (uint32_t p = 0; p < _spriteOrder.size(); p++) {
+			_spriteSlots[_spriteOrder[p] & slotMask].position = p;
+		}
+
+		Vk.BatchQuads(_spriteOrder, _spriteBatches);
+
+		// everything moved, so everything is uploaded
+		_dirtySpritePositions.clear();
+		if (!_spriteOrder.empty()) {
+			Vk.EnsureSpritesBufferCapacity((uint32_t)_spriteOrder.size());
+			ranges.push_back({0, (uint32_t)_spriteOrder.size()});
+		}
+	} else if (!_dirtySpritePositions.empty()) {
+		std::sort(_dirtySpritePositions.begin(), _dirtySpritePositions.end());
+
+		for (uint32_t p : _dirtySpritePositions) {
+			if (!ranges.empty() &&
+			    p <= ranges.back().first + ranges.back().second) {
+				ranges.back().second =
+				    std::max(ranges.back().second,
+				             p - ranges.back().first + 1);
+			} else {
+				ranges.push_back({p, 1});
+			}
+		}
+
+		_dirtySpritePositions.clear();
+	}
+
+	if (ranges.empty()) {
+		return;
+	}
+
+	uint32_t total = 0;
+	for (auto [first, count] : ranges) {
+		total += count;
+	}
+
+	QuadData *staging = Vk.StageSprites(total);
+
+	// positions whose sprite was destroyed or is waiting for its texture get
+	// a quad that covers nothing
+	const uint64_t slotMask = (1ull << QUAD_KEY_SEQUENCE_BITS) - 1;
+	const QuadData empty =
+	    QuadData(Quad(0, 0, 0, 0), Color{0, 0, 0, 0}, DrawQuadOptions());
+
+	std::vector<VkBufferCopy> regions;
+	regions.reserve(ranges.size());
+
+	uint32_t staged = 0;
+	for (auto [first, count] : ranges) {
+		VkBufferCopy region;
+		region.srcOffset = (VkDeviceSize)staged * sizeof(QuadData);
+		region.dstOffset = (VkDeviceSize)first * sizeof(QuadData);
+		region.size      = (VkDeviceSize)count * sizeof(QuadData);
+		regions.push_back(region);
+
+		for (uint32_t p = first; p < first + count; p++) {
+			const SpriteSlot &slot = _spriteSlots[_spriteOrder[p] & slotMask];
+			bool current = slot.alive && slot.position == p &&
+			               slot.data.has_value();
+
+			staging[staged++] = current ? slot.data.value() : empty;
+		}
+	}
+
+	Vk.RecordSpritesUpload(cmd, regions);
+}
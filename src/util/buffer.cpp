@@ -5,7 +5,8 @@
 using namespace azu;
 
 Buffer::Buffer(const VmaAllocator &allocator, uint32_t size,
-               VkBufferUsageFlags bufferUsage, VmaMemoryUsage memoryUsage) {
+               VkBufferUsageFlags bufferUsage, VmaMemoryUsage memoryUsage)
+    : Size(size) {
 	VkBufferCreateInfo bufferInfo =
 	    vk_init::bufferCreateInfo(size, bufferUsage);
 
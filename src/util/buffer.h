@@ -10,6 +10,7 @@ class Buffer {
   public:
 	VkBuffer VulkanBuffer;
 	VmaAllocation Allocation;
+	uint32_t Size; // Unit: bytes
 
 	void *Data;
 
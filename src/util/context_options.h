@@ -0,0 +1,72 @@
+#ifndef UTIL_CONTEXT_OPTIONS_H
+#define UTIL_CONTEXT_OPTIONS_H
+
+#include <cstdint>
+
+namespace azu {
+
+enum class PresentMode {
+	Fifo,        // vsync, never tears
+	FifoRelaxed, // vsync, but tears instead of waiting when a frame is late
+	Mailbox,     // uncapped, never tears, only the newest frame is shown
+	Immediate    // uncapped, tears
+};
+
+struct ContextOptions {
+	// How many frames the CPU is allowed to record ahead of the GPU. 1 means
+	// the CPU waits for the GPU to finish every frame before starting the next
+	// one, anything above that lets them work in parallel at the cost of a
+	// bit of latency and a quads buffer per frame
+	uint32_t framesInFlight = 2;
+
+	// Falls back to the closest supported mode (and ultimately to Fifo, which
+	// is always supported) if the surface doesn't support this one
+	PresentMode presentMode = PresentMode::Fifo;
+
+	// Minimum number of swapchain images to ask the driver for. 0 leaves it
+	// to vk-bootstrap, which asks for one more than the driver's minimum
+	uint32_t minSwapchainImageCount = 0;
+
+	// Don't create a window at all and render into an offscreen image of the
+	// given size instead. The present mode and swapchain options are ignored.
+	// Works without any display (e.g. with a software driver like lavapipe)
+	bool headless = false;
+
+	// Pack small textures into a few shared atlas pages instead of giving
+	// each one its own image and descriptor. Pages that haven't been drawn
+	// from in a while get evicted when they're all full
+	bool useTextureAtlas = true;
+
+	// Generate a mip chain for every texture that has its own image, so that
+	// minified textures are sampled trilinearly instead of aliasing. Ignored
+	// if the GPU can't blit the texture format with linear filtering
+	bool generateMipmaps = true;
+
+	// Bytes of texture memory to stay under. Textures that haven't been drawn
+	// for the longest (and at least a couple of seconds) are evicted when
+	// it's exceeded, and loaded from their file again the next time they're
+	// drawn. Textures are also evicted when the GPU runs low on memory, 0
+	// means that's the only limit. Nothing is evicted if that wouldn't be
+	// enough to get back under the limit
+	uint64_t textureMemoryBudget = 0;
+
+	// Render with a depth buffer, so opaque quads can be drawn front to back
+	// first and hide whatever is behind them before it's shaded. Ignored if
+	// the GPU doesn't support the depth format. EndDraw throws if a frame
+	// has more than 2^23 quads and sprites while it's on
+	bool depthBuffer = true;
+
+	// Keep the compiled pipelines in a cache on disk, so launches after the
+	// first one don't have to wait for the driver to compile them
+	bool pipelineCache = true;
+
+	// Directory the pipeline cache is kept in, created if it doesn't exist.
+	// nullptr uses the per-user directory SDL_GetPrefPath gives azu (e.g.
+	// ~/.local/share/azu/ on Linux), which every program using azu shares
+	// since they all build the same pipelines
+	const char *pipelineCacheDirectory = nullptr;
+};
+
+} // namespace azu
+
+#endif // UTIL_CONTEXT_OPTIONS_H
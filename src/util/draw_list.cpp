@@ -0,0 +1,43 @@
+#include "draw_list.h"
+
+using namespace azu;
+
+void DrawList::DrawQuad(Quad quad, Color color,
+                        std::optional<DrawQuadOptions> options) {
+	DrawQuadOptions opt =
+	    options.has_value() ? options.value() : DrawQuadOptions();
+
+	_quads.push_back(QuadData(quad, color, opt));
+	_keys.push_back(quadSortKey(_quads.back(), opt.layer));
+}
+
+void DrawList::DrawQuad(Quad quad, TextureHandle texture,
+                        std::optional<DrawQuadOptions> options) {
+	DrawQuadOptions opt =
+	    options.has_value() ? options.value() : DrawQuadOptions();
+
+	// runs of quads with the same texture skip the lookup
+	if (!_texturedQuads.empty() &&
+	    _textures[_texturedQuads.back().texture] == texture) {
+		_texturedQuads.push_back({quad, _texturedQuads.back().texture, opt});
+		return;
+	}
+
+	uint64_t key = (uint64_t)texture.index << 32 | texture.generation;
+
+	auto [it, inserted] =
+	    _textureIndices.try_emplace(key, (uint32_t)_textures.size());
+	if (inserted) {
+		_textures.push_back(texture);
+	}
+
+	_texturedQuads.push_back({quad, it->second, opt});
+}
+
+void DrawList::Clear() {
+	_quads.clear();
+	_keys.clear();
+	_texturedQuads.clear();
+	_textures.clear();
+	_textureIndices.clear();
+}
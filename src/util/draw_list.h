@@ -0,0 +1,71 @@
+#ifndef UTIL_DRAW_LIST_H
+#define UTIL_DRAW_LIST_H
+
+#include "color.h"
+#include "geometry.h"
+#include "quad_data.h"
+#include "texture.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace azu {
+
+class Context;
+
+// Records quads without touching the Context, so worker threads can each
+// fill their own list in parallel, without locking. The lists are handed to
+// Context::SubmitDrawList once they're filled, and merged into the frame by
+// EndDraw. A list's storage is kept by Clear, so a list that's reused every
+// frame stops allocating once it has grown to fit
+class DrawList {
+	friend class Context;
+
+	// quads that don't need the Context, with their sort keys (without the
+	// sequence part, which depends on where the list ends up in the frame)
+	std::vector<QuadData> _quads;
+	std::vector<uint64_t> _keys;
+
+	// Textured quads wait for EndDraw to look up their texture, since that
+	// can start loading it again. Every texture the list uses is only in
+	// _textures once, so EndDraw looks each of them up once, and the quads
+	// refer to them by their index in it
+	struct TexturedQuad {
+		Quad quad;
+		uint32_t texture;
+		DrawQuadOptions options;
+	};
+	std::vector<TexturedQuad> _texturedQuads;
+	std::vector<TextureHandle> _textures;
+	std::unordered_map<uint64_t, uint32_t> _textureIndices;
+
+  public:
+	// Lists are merged after the quads from Context::DrawQuad, from the
+	// lowest priority to the highest, and in the order they were submitted
+	// for equal priorities. Quads with the same layer, pipeline variant and
+	// texture are drawn in that order, so it doesn't depend on which thread
+	// finished first
+	int32_t Priority = 0;
+
+	DrawList() = default;
+	explicit DrawList(int32_t priority) : Priority(priority) {}
+
+	// Same as Context::DrawQuad
+	void DrawQuad(Quad quad, Color color,
+	              std::optional<DrawQuadOptions> options = std::nullopt);
+	void DrawQuad(Quad quad, TextureHandle texture,
+	              std::optional<DrawQuadOptions> options = std::nullopt);
+
+	// Forgets every quad, but keeps the storage for them
+	void Clear();
+
+	size_t QuadCount() const {
+		return _quads.size() + _texturedQuads.size();
+	}
+};
+
+} // namespace azu
+
+#endif // UTIL_DRAW_LIST_H
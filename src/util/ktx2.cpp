@@ -0,0 +1,172 @@
+#include "ktx2.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+
+using namespace azu;
+
+// https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+
+static const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58,
+                                            0x20, 0x32, 0x30, 0xBB,
+                                            0x0D, 0x0A, 0x1A, 0x0A};
+
+struct Ktx2Header {
+	uint8_t identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+struct Ktx2LevelIndex {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header has to be 80 bytes");
+static_assert(sizeof(Ktx2LevelIndex) == 24,
+              "KTX2 level index entries have to be 24 bytes");
+
+// bytes per 4x4 block, or 0 for formats that aren't supported
+static uint32_t blockSize(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		return 8;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+bool azu::IsKtx2File(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+
+	uint8_t identifier[12];
+	bool isKtx2 = fread(identifier, 1, sizeof(identifier), file) ==
+	                  sizeof(identifier) &&
+	              memcmp(identifier, KTX2_IDENTIFIER, sizeof(identifier)) == 0;
+
+	fclose(file);
+
+	return isKtx2;
+}
+
+std::optional<Ktx2Image> azu::LoadKtx2File(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		return std::nullopt;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	std::vector<uint8_t> contents(fileSize > 0 ? (size_t)fileSize : 0);
+	bool read = fread(contents.data(), 1, contents.size(), file) ==
+	            contents.size();
+
+	fclose(file);
+
+	if (!read || contents.size() < sizeof(Ktx2Header)) {
+		return std::nullopt;
+	}
+
+	Ktx2Header header;
+	memcpy(&header, contents.data(), sizeof(header));
+
+	if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER))) {
+		return std::nullopt;
+	}
+
+	VkFormat format = (VkFormat)header.vkFormat;
+	if (blockSize(format) == 0 || header.pixelWidth == 0 ||
+	    header.pixelHeight == 0 || header.pixelDepth != 0 ||
+	    header.layerCount > 1 || header.faceCount != 1 ||
+	    header.supercompressionScheme != 0) {
+		return std::nullopt;
+	}
+
+	// 0 means the loader is supposed to generate the mip chain, which isn't
+	// possible for compressed data, so only the base level is used
+	uint32_t levelCount = std::max(header.levelCount, 1u);
+	if (levelCount >
+	    (uint32_t)std::bit_width(std::max(header.pixelWidth,
+	                                      header.pixelHeight))) {
+		return std::nullopt;
+	}
+
+	if (contents.size() <
+	    sizeof(Ktx2Header) + levelCount * sizeof(Ktx2LevelIndex)) {
+		return std::nullopt;
+	}
+
+	std::vector<Ktx2LevelIndex> levels(levelCount);
+	memcpy(levels.data(), contents.data() + sizeof(Ktx2Header),
+	       levelCount * sizeof(Ktx2LevelIndex));
+
+	// the levels are usually stored smallest first, only the range they span
+	// is kept
+	uint64_t start = UINT64_MAX;
+	uint64_t end   = 0;
+
+	for (uint32_t level = 0; level < levelCount; level++) {
+		uint32_t width  = std::max(header.pixelWidth >> level, 1u);
+		uint32_t height = std::max(header.pixelHeight >> level, 1u);
+
+		uint64_t expectedLength = (uint64_t)((width + 3) / 4) *
+		                          ((height + 3) / 4) * blockSize(format);
+
+		// written so a huge byteOffset can't wrap the sum around. The offset
+		// ends up as the copy's bufferOffset, which has to be a multiple of
+		// the block size
+		const Ktx2LevelIndex &index = levels[level];
+		if (index.byteLength != expectedLength ||
+		    index.byteOffset > contents.size() ||
+		    index.byteLength > contents.size() - index.byteOffset ||
+		    index.byteOffset % blockSize(format) != 0) {
+			return std::nullopt;
+		}
+
+		start = std::min(start, index.byteOffset);
+		end   = std::max(end, index.byteOffset + index.byteLength);
+	}
+
+	Ktx2Image image;
+	image.format = format;
+	image.width  = header.pixelWidth;
+	image.height = header.pixelHeight;
+	image.data   = std::vector<uint8_t>(contents.begin() + (ptrdiff_t)start,
+	                                    contents.begin() + (ptrdiff_t)end);
+
+	for (const Ktx2LevelIndex &index : levels) {
+		image.levelOffsets.push_back(index.byteOffset - start);
+	}
+
+	return image;
+}
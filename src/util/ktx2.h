@@ -0,0 +1,33 @@
+#ifndef UTIL_KTX2_H
+#define UTIL_KTX2_H
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace azu {
+
+// A block compressed 2D texture read from a KTX2 container, with all of its
+// mip levels ready to be copied into an image as they are
+struct Ktx2Image {
+	VkFormat format;
+	uint32_t width;
+	uint32_t height;
+
+	// every level, back to back in whatever order the file stores them
+	std::vector<uint8_t> data;
+	// where each level starts in data, starting with the biggest one
+	std::vector<uint64_t> levelOffsets;
+};
+
+// Whether the file starts with the KTX2 identifier
+bool IsKtx2File(const char *path);
+
+// Only supports single 2D images in BC1, BC3 or BC7 formats without
+// supercompression, returns nothing for anything else
+std::optional<Ktx2Image> LoadKtx2File(const char *path);
+
+} // namespace azu
+
+#endif // UTIL_KTX2_H
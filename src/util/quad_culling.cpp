@@ -0,0 +1,66 @@
+#include "quad_culling.h"
+
+#include "util.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#define AZU_CULL_SSE
+#include <xmmintrin.h>
+#endif
+
+using namespace azu;
+
+static bool isVisible(const Quad &quad, float width, float height) {
+	return quad.pos.x < width && quad.pos.y < height &&
+	       quad.pos.x + quad.size.x > 0.0f && quad.pos.y + quad.size.y > 0.0f;
+}
+
+uint32_t azu::CullQuads(std::span<const QuadData> quads,
+                        std::vector<uint64_t> &keys, float width,
+                        float height) {
+	ASSERT(quads.size() == keys.size(), "Every quad needs exactly one key");
+
+	const uint32_t count = (uint32_t)keys.size();
+
+	// keys are compacted in place, every key is written whether it's kept or
+	// not and only the kept ones advance the write position, so there's no
+	// branch on visibility
+	uint32_t kept = 0;
+	uint32_t i    = 0;
+
+#ifdef AZU_CULL_SSE
+	const __m128 zero   = _mm_setzero_ps();
+	const __m128 right  = _mm_set1_ps(width);
+	const __m128 bottom = _mm_set1_ps(height);
+
+	for (; i + 4 <= count; i += 4) {
+		// the Quad is the first 16 bytes of QuadData: x, y, width, height.
+		// Transposing four of them gives each of those for all four quads
+		__m128 x = _mm_loadu_ps(&quads[i].quad.pos.x);
+		__m128 y = _mm_loadu_ps(&quads[i + 1].quad.pos.x);
+		__m128 w = _mm_loadu_ps(&quads[i + 2].quad.pos.x);
+		__m128 h = _mm_loadu_ps(&quads[i + 3].quad.pos.x);
+		_MM_TRANSPOSE4_PS(x, y, w, h);
+
+		__m128 visible =
+		    _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(x, right),
+		                          _mm_cmplt_ps(y, bottom)),
+		               _mm_and_ps(_mm_cmpgt_ps(_mm_add_ps(x, w), zero),
+		                          _mm_cmpgt_ps(_mm_add_ps(y, h), zero)));
+		int mask = _mm_movemask_ps(visible);
+
+		for (uint32_t j = 0; j < 4; j++) {
+			keys[kept] = keys[i + j];
+			kept += (mask >> j) & 1;
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		keys[kept] = keys[i];
+		kept += isVisible(quads[i].quad, width, height) ? 1 : 0;
+	}
+
+	keys.resize(kept);
+
+	return count - kept;
+}
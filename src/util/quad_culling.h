@@ -0,0 +1,20 @@
+#ifndef UTIL_QUAD_CULLING_H
+#define UTIL_QUAD_CULLING_H
+
+#include "quad_data.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace azu {
+
+// Removes the keys of the quads that lie entirely outside of the viewport
+// from (0, 0) to (width, height), keeping the rest in order. keys[i] has to
+// belong to quads[i]. Four quads are tested at a time with SSE where it's
+// available. Returns how many keys were removed
+uint32_t CullQuads(std::span<const QuadData> quads,
+                   std::vector<uint64_t> &keys, float width, float height);
+
+} // namespace azu
+
+#endif // UTIL_QUAD_CULLING_H
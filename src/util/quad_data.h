@@ -3,6 +3,7 @@
 
 #include "src/util/geometry.h"
 #include "src/util/color.h"
+#include <cstddef>
 #include <cstdint>
 
 namespace azu {
@@ -27,10 +28,16 @@ struct DrawQuadOptions {
 	QuadCornerValues radius;
 	float opacity;
 
-	DrawQuadOptions(const QuadCornerValues &radius, float opacity)
-	    : radius(radius), opacity(opacity) {}
+	// Quads in higher layers are drawn over the ones in lower layers. Within
+	// a layer quads are grouped by pipeline variant and texture before draw
+	// order, so quads that overlap should be put in different layers
+	int16_t layer;
 
-	DrawQuadOptions() : radius(QuadCornerValues()), opacity(1.0) {}
+	DrawQuadOptions(const QuadCornerValues &radius, float opacity,
+	                int16_t layer = 0)
+	    : radius(radius), opacity(opacity), layer(layer) {}
+
+	DrawQuadOptions() : radius(QuadCornerValues()), opacity(1.0), layer(0) {}
 };
 
 enum class QuadDataFillType {
@@ -38,25 +45,132 @@ enum class QuadDataFillType {
 	Texture = 2
 };
 
+// The quad pipeline comes in variants built from the same shaders with
+// specialization constants, so quads only pay for the features they use.
+// A variant can draw any quad whose flags are a subset of its own
+enum QuadPipelineFlags : uint32_t {
+	QUAD_PIPELINE_ROUNDED  = 1 << 0, // evaluates the rounded-box SDF
+	QUAD_PIPELINE_TEXTURED = 1 << 1, // samples from the texture array
+	QUAD_PIPELINE_BLENDED  = 1 << 2, // alpha blending is enabled
+};
+
+const uint32_t QUAD_PIPELINE_COUNT = 8; // one for every combination of flags
+
+// Clamps v to [0, 1] and maps it to [0, 2^bits - 1], like GLSL's packUnorm
+inline uint32_t packUnorm(float v, uint32_t bits) {
+	float max     = (float)((1u << bits) - 1);
+	float clamped = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+	return (uint32_t)(clamped * max + 0.5f);
+}
+
+// What's uploaded for every quad. The layout has to match QuadData in
+// quad.vert and quad.frag (std430), which unpack the quantized fields again
 struct QuadData {
 	Quad quad;
-	Color color;
-	uint32_t textureId;
-	QuadDataFillType fillType;
-	uint8_t __padding1[8];
-	DrawQuadOptions options;
-	uint8_t __padding2[12];
+
+	// color fills: the color as RGBA8 in fill[0]
+	// texture fills: the UV rect as unorm16s, x and y in fill[0], width and
+	// height in fill[1]
+	uint32_t fill[2];
+
+	// the corner radii as unorm8s: top left, top right, bottom left and
+	// bottom right from the lowest byte up
+	uint32_t radius;
+
+	// bits 0-15: texture index, 16-23: opacity as unorm8, 24-30: fill type,
+	// 31: the texture has no translucent texels (see Texture::opaque)
+	uint32_t packed;
 
 	QuadData(Quad quad, Color color, DrawQuadOptions options)
-	    : quad(quad), color(color), textureId(0),
-	      fillType(QuadDataFillType::Color), options(options) {}
+	    : quad(quad), radius(_packRadius(options.radius)) {
+		fill[0] = packUnorm(color.r, 8) | packUnorm(color.g, 8) << 8 |
+		          packUnorm(color.b, 8) << 16 | packUnorm(color.a, 8) << 24;
+		fill[1] = 0;
+		packed  = _pack(0, options.opacity, QuadDataFillType::Color);
+	}
+
+	QuadData(Quad quad, uint32_t textureId, Quad uvRect,
+	         DrawQuadOptions options, bool opaqueTexture)
+	    : quad(quad), radius(_packRadius(options.radius)) {
+		fill[0] =
+		    packUnorm(uvRect.pos.x, 16) | packUnorm(uvRect.pos.y, 16) << 16;
+		fill[1] =
+		    packUnorm(uvRect.size.x, 16) | packUnorm(uvRect.size.y, 16) << 16;
+		packed = _pack(textureId, options.opacity, QuadDataFillType::Texture);
+		if (opaqueTexture) {
+			packed |= OPAQUE_TEXTURE_BIT;
+		}
+	}
+
+	// The QuadPipelineFlags of the cheapest variant that draws this quad
+	// correctly. Rounded corners always need blending for their antialiased
+	// edges, textures only if some of their texels are translucent
+	uint32_t PipelineFlags() const {
+		uint32_t flags = 0;
 
-	QuadData(Quad quad, uint32_t textureId, DrawQuadOptions options)
-	    : quad(quad), color(Color::rgba(0.0, 0.0, 0.0, 0.0)),
-	      textureId(textureId), fillType(QuadDataFillType::Texture),
-	      options(options) {}
+		if (radius != 0) {
+			flags |= QUAD_PIPELINE_ROUNDED | QUAD_PIPELINE_BLENDED;
+		}
+
+		if (((packed >> 24) & 0x7F) == (uint32_t)QuadDataFillType::Texture) {
+			flags |= QUAD_PIPELINE_TEXTURED;
+			if (!(packed & OPAQUE_TEXTURE_BIT)) {
+				flags |= QUAD_PIPELINE_BLENDED;
+			}
+		} else if ((fill[0] >> 24) != 0xFF) {
+			flags |= QUAD_PIPELINE_BLENDED; // translucent color
+		}
+
+		if (((packed >> 16) & 0xFF) != 0xFF) {
+			flags |= QUAD_PIPELINE_BLENDED; // translucent quad
+		}
+
+		return flags;
+	}
+
+  private:
+	static const uint32_t OPAQUE_TEXTURE_BIT = 1u << 31;
+
+	static uint32_t _packRadius(const QuadCornerValues &radius) {
+		return packUnorm(radius.topLeft, 8) |
+		       packUnorm(radius.topRight, 8) << 8 |
+		       packUnorm(radius.bottomLeft, 8) << 16 |
+		       packUnorm(radius.bottomRight, 8) << 24;
+	}
+
+	static uint32_t _pack(uint32_t textureId, float opacity,
+	                      QuadDataFillType fillType) {
+		return (textureId & 0xFFFF) | packUnorm(opacity, 8) << 16 |
+		       (uint32_t)fillType << 24;
+	}
 };
 
+static_assert(sizeof(QuadData) == 32, "QuadData has to be 32 bytes");
+static_assert(offsetof(QuadData, quad) == 0);
+static_assert(offsetof(QuadData, fill) == 16);
+static_assert(offsetof(QuadData, radius) == 24);
+static_assert(offsetof(QuadData, packed) == 28);
+
+// Quads are drawn in the order of 64 bit keys made of, from the highest bit
+// down: the layer (16 bits), the pipeline variant (3), the texture (16) and
+// the order they were pushed in (29)
+const uint32_t QUAD_KEY_SEQUENCE_BITS  = 29;
+const uint32_t QUAD_KEY_TEXTURE_SHIFT  = 29;
+const uint32_t QUAD_KEY_PIPELINE_SHIFT = 45;
+const uint32_t QUAD_KEY_LAYER_SHIFT    = 48;
+
+// The sort key of a quad without the sequence part
+inline uint64_t quadSortKey(const QuadData &quad, int16_t layer) {
+	// layers are signed, offsetting them keeps them in order as unsigned
+	uint64_t layerBits    = (uint16_t)(layer + 0x8000);
+	uint64_t pipelineBits = quad.PipelineFlags();
+	uint64_t textureBits  = quad.packed & 0xFFFF; // 0 for color quads
+
+	return layerBits << QUAD_KEY_LAYER_SHIFT |
+	       pipelineBits << QUAD_KEY_PIPELINE_SHIFT |
+	       textureBits << QUAD_KEY_TEXTURE_SHIFT;
+}
+
 } // namespace azu
 
 #endif // UTIL_QUAD_DATA_H
\ No newline at end of file
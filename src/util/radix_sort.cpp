@@ -0,0 +1,52 @@
+#include "radix_sort.h"
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+using namespace azu;
+
+void azu::RadixSort(std::vector<uint64_t> &keys,
+                    std::vector<uint64_t> &scratch, uint32_t lowestBit) {
+	if (keys.size() < 2) {
+		return;
+	}
+
+	const uint32_t passCount = (64 - lowestBit + 7) / 8;
+
+	// the histograms of every pass are gathered in a single read of the keys.
+	// There are at most 8 passes, so they fit on the stack
+	std::array<uint32_t, 8 * 256> counts{};
+	for (uint64_t key : keys) {
+		for (uint32_t pass = 0; pass < passCount; pass++) {
+			uint32_t digit = (uint32_t)(key >> (lowestBit + pass * 8)) & 0xFF;
+			counts[pass * 256 + digit]++;
+		}
+	}
+
+	scratch.resize(keys.size());
+
+	for (uint32_t pass = 0; pass < passCount; pass++) {
+		const uint32_t shift = lowestBit + pass * 8;
+		uint32_t *passCounts = counts.data() + pass * 256;
+
+		// every key has the same digit, so the pass wouldn't move anything
+		if (passCounts[(keys[0] >> shift) & 0xFF] == keys.size()) {
+			continue;
+		}
+
+		// turn the counts into the offset each digit's keys start at
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < 256; digit++) {
+			uint32_t count    = passCounts[digit];
+			passCounts[digit] = offset;
+			offset += count;
+		}
+
+		for (uint64_t key : keys) {
+			scratch[passCounts[(key >> shift) & 0xFF]++] = key;
+		}
+
+		std::swap(keys, scratch);
+	}
+}
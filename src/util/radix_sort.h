@@ -0,0 +1,18 @@
+#ifndef UTIL_RADIX_SORT_H
+#define UTIL_RADIX_SORT_H
+
+#include <cstdint>
+#include <vector>
+
+namespace azu {
+
+// Sorts keys by their bits from lowestBit up, one byte per pass. The sort is
+// stable, so keys that are already in order in the bits below lowestBit stay
+// in order. Passes over bytes that are the same in every key are skipped.
+// scratch is resized to fit and can be reused between calls
+void RadixSort(std::vector<uint64_t> &keys, std::vector<uint64_t> &scratch,
+               uint32_t lowestBit = 0);
+
+} // namespace azu
+
+#endif // UTIL_RADIX_SORT_H
@@ -0,0 +1,109 @@
+#include "skyline_packer.h"
+
+#include <algorithm>
+
+using namespace azu;
+
+SkylinePacker::SkylinePacker(uint32_t width, uint32_t height)
+    : _width(width), _height(height) {
+	Reset();
+}
+
+void SkylinePacker::Reset() {
+	_skyline.clear();
+	_skyline.push_back({0, 0, _width});
+}
+
+std::optional<uint32_t> SkylinePacker::_fit(size_t index, uint32_t width,
+                                            uint32_t height) const {
+	uint32_t x = _skyline[index].x;
+	if (x + width > _width) {
+		return std::nullopt;
+	}
+
+	// the rectangle rests on the highest node it spans
+	uint32_t y         = 0;
+	uint32_t remaining = width;
+	for (size_t i = index; remaining > 0; i++) {
+		y = std::max(y, _skyline[i].y);
+		if (y + height > _height) {
+			return std::nullopt;
+		}
+
+		remaining -= std::min(remaining, _skyline[i].width);
+	}
+
+	return y;
+}
+
+std::optional<std::pair<uint32_t, uint32_t>>
+SkylinePacker::Pack(uint32_t width, uint32_t height) {
+	if (width == 0 || height == 0) {
+		return std::nullopt;
+	}
+
+	// find the position where the rectangle's bottom edge ends up the
+	// highest (lowest y), preferring the narrowest node on a tie
+	size_t bestIndex    = SIZE_MAX;
+	uint32_t bestBottom = UINT32_MAX;
+	uint32_t bestWidth  = UINT32_MAX;
+	uint32_t bestY      = 0;
+
+	for (size_t i = 0; i < _skyline.size(); i++) {
+		std::optional<uint32_t> y = _fit(i, width, height);
+		if (!y.has_value()) {
+			continue;
+		}
+
+		uint32_t bottom = y.value() + height;
+		if (bottom < bestBottom ||
+		    (bottom == bestBottom && _skyline[i].width < bestWidth)) {
+			bestIndex  = i;
+			bestBottom = bottom;
+			bestWidth  = _skyline[i].width;
+			bestY      = y.value();
+		}
+	}
+
+	if (bestIndex == SIZE_MAX) {
+		return std::nullopt;
+	}
+
+	uint32_t x = _skyline[bestIndex].x;
+
+	_skyline.insert(_skyline.begin() + (ptrdiff_t)bestIndex,
+	                {x, bestBottom, width});
+
+	// shrink or remove the nodes the new one now covers
+	for (size_t i = bestIndex + 1; i < _skyline.size();) {
+		Node &previous = _skyline[i - 1];
+		Node &node     = _skyline[i];
+
+		uint32_t previousEnd = previous.x + previous.width;
+		if (node.x >= previousEnd) {
+			break;
+		}
+
+		uint32_t shrink = previousEnd - node.x;
+		if (shrink >= node.width) {
+			_skyline.erase(_skyline.begin() + (ptrdiff_t)i);
+			continue;
+		}
+
+		node.x += shrink;
+		node.width -= shrink;
+		break;
+	}
+
+	// merge neighbours of the same height
+	for (size_t i = 0; i + 1 < _skyline.size();) {
+		if (_skyline[i].y == _skyline[i + 1].y) {
+			_skyline[i].width += _skyline[i + 1].width;
+			_skyline.erase(_skyline.begin() + (ptrdiff_t)i + 1);
+		} else {
+			i++;
+		}
+	}
+
+	return std::make_pair(x, bestY);
+}
@@ -0,0 +1,47 @@
+#ifndef UTIL_SKYLINE_PACKER_H
+#define UTIL_SKYLINE_PACKER_H
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace azu {
+
+// Packs rectangles into a fixed size area using the bottom-left skyline
+// heuristic. Only the top edge of everything packed so far is tracked, so
+// space below an overhang is lost, but packing is fast and good enough for
+// sprites, which tend to be of similar sizes
+class SkylinePacker {
+	struct Node {
+		uint32_t x;
+		uint32_t y;
+		uint32_t width;
+	};
+
+	uint32_t _width;
+	uint32_t _height;
+
+	std::vector<Node> _skyline;
+
+	// the y a rectangle of the given width would be placed at if its left
+	// edge started at the node at index, or nothing if it doesn't fit there
+	std::optional<uint32_t> _fit(size_t index, uint32_t width,
+	                             uint32_t height) const;
+
+  public:
+	SkylinePacker() = default;
+	SkylinePacker(uint32_t width, uint32_t height);
+
+	// Returns the top left corner of the packed rectangle, or nothing if
+	// there's no room left for it
+	std::optional<std::pair<uint32_t, uint32_t>> Pack(uint32_t width,
+	                                                  uint32_t height);
+
+	// Forgets everything packed so far
+	void Reset();
+};
+
+} // namespace azu
+
+#endif // UTIL_SKYLINE_PACKER_H
@@ -0,0 +1,19 @@
+#ifndef UTIL_SPRITE_H
+#define UTIL_SPRITE_H
+
+#include <cstdint>
+
+namespace azu {
+
+// A quad that's kept on the GPU across frames, see Context::CreateSprite.
+// Works like a TextureHandle, handles to destroyed sprites are detected
+struct SpriteHandle {
+	uint32_t index      = UINT32_MAX;
+	uint32_t generation = 0;
+
+	bool operator==(const SpriteHandle &other) const = default;
+};
+
+} // namespace azu
+
+#endif // UTIL_SPRITE_H
@@ -1,19 +1,69 @@
 #ifndef UTIL_TEXTURE_H
 #define UTIL_TEXTURE_H
 
+#include "geometry.h"
 #include "vk_mem_alloc.h"
 #include <vulkan/vulkan.h>
 #include <cstdint>
 
 namespace azu {
 
+// Cheap to copy and compare, meant to be kept around instead of a texture's
+// name. The generation makes handles to destroyed textures detectable even
+// after their slot has been reused
+struct TextureHandle {
+	uint32_t index      = UINT32_MAX;
+	uint32_t generation = 0;
+
+	bool operator==(const TextureHandle &other) const = default;
+};
+
+// One file for Context::CreateTexturesFromFiles
+struct TextureFile {
+	const char *name; // can be nullptr
+	const char *path;
+};
+
+const uint32_t NO_ATLAS_PAGE = UINT32_MAX;
+
 struct Texture {
+	// for atlas entries these are the atlas page's, and aren't owned by the
+	// texture
 	VkImage image;
 	VmaAllocation allocation;
 	VkImageView imageView;
 	uint32_t width;
 	uint32_t height;
-	uint32_t vkId;
+	uint32_t vkId;        // index into the texture descriptor array
+	uint64_t uploadValue; // see VkContext::IsUploadComplete
+
+	uint32_t mipLevels     = 1;
+	uint64_t memorySize    = 0; // 0 for atlas entries
+	uint32_t lastUsedFrame = 0; // FrameNumber it was last drawn on
+	uint32_t loadedFrame   = 0; // FrameNumber its image was (re)created on
+	// the upload has to complete and BeginDraw has to generate the mip chain
+	// before the texture can be drawn
+	bool mipmapsPending = false;
+
+	// index of the atlas page the texture was packed into, if it was
+	uint32_t atlasPage = NO_ATLAS_PAGE;
+	// the part of the image the texture covers, in UV coordinates
+	Quad uvRect = Quad(0.0f, 0.0f, 1.0f, 1.0f);
+	// every texel's alpha is 1, so opaque quads drawing it don't need
+	// blending
+	bool opaque = false;
+	// false if the texture (or its atlas page) was evicted, in which case it
+	// has to be loaded again before it can be drawn
+	bool resident = true;
+	// in Context::_pendingReloads, to be loaded again by the next BeginDraw
+	bool reloadRequested = false;
+	// loading it again failed this many times in a row, and isn't tried
+	// again before FrameNumber reaches reloadRetryFrame
+	uint32_t reloadFailures   = 0;
+	uint32_t reloadRetryFrame = 0;
+	// number of sprites drawing the texture, which keep it (and its atlas
+	// page) from being evicted
+	uint32_t spriteCount = 0;
 };
 
 } // namespace azu
@@ -0,0 +1,80 @@
+#include "thread_pool.h"
+
+#include <system_error>
+#include <utility>
+
+using namespace azu;
+
+ThreadPool::ThreadPool() {
+	uint32_t threadCount = std::thread::hardware_concurrency();
+	if (threadCount > 0) {
+		threadCount--;
+	}
+
+	// if a thread can't be started the pool just has fewer of them
+	_threads.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; i++) {
+		try {
+			_threads.emplace_back(&ThreadPool::_work, this);
+		} catch (const std::system_error &) {
+			break;
+		}
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_jobPushed.notify_all();
+
+	for (std::thread &thread : _threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::_work() {
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_jobPushed.wait(lock,
+			                [&]() { return _stopping || !_jobs.empty(); });
+
+			if (_stopping) {
+				return;
+			}
+
+			job = std::move(_jobs.front());
+			_jobs.pop_front();
+		}
+
+		job.run();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			job.group->_pending--;
+		}
+		_jobFinished.notify_all();
+	}
+}
+
+void JobGroup::Push(std::function<void()> job) {
+	if (_pool._threads.empty()) {
+		job();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_pool._mutex);
+		_pool._jobs.push_back({std::move(job), this});
+		_pending++;
+	}
+	_pool._jobPushed.notify_one();
+}
+
+void JobGroup::Wait() {
+	std::unique_lock<std::mutex> lock(_pool._mutex);
+	_pool._jobFinished.wait(lock, [&]() { return _pending == 0; });
+}
@@ -0,0 +1,81 @@
+#ifndef UTIL_THREAD_POOL_H
+#define UTIL_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace azu {
+
+class JobGroup;
+
+// Worker threads that are started once and kept until the pool is
+// destroyed, so work can be spread over the CPU cores every frame without
+// starting threads every time. Jobs are pushed through a JobGroup
+class ThreadPool {
+	friend class JobGroup;
+
+	struct Job {
+		std::function<void()> run;
+		JobGroup *group;
+	};
+
+	std::vector<std::thread> _threads;
+
+	std::mutex _mutex;
+	std::condition_variable _jobPushed;
+	std::condition_variable _jobFinished;
+	std::deque<Job> _jobs;
+	bool _stopping = false;
+
+	void _work();
+
+  public:
+	// One worker per CPU core besides the one the pool is used from
+	ThreadPool();
+	ThreadPool(const ThreadPool &)            = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	// How many jobs can run at the same time
+	uint32_t GetThreadCount() const {
+		return (uint32_t)_threads.size();
+	}
+
+	// Jobs that are still queued are dropped, the running ones are finished
+	~ThreadPool();
+};
+
+// Jobs that are waited for together. Destroying the group waits for its
+// jobs as well, so they can safely use anything declared before it, even
+// when an exception is thrown
+class JobGroup {
+	friend class ThreadPool;
+
+	ThreadPool &_pool;
+	uint32_t _pending = 0; // guarded by the pool's mutex
+
+  public:
+	explicit JobGroup(ThreadPool &pool) : _pool(pool) {}
+	JobGroup(const JobGroup &)            = delete;
+	JobGroup &operator=(const JobGroup &) = delete;
+
+	// Queues job to be run on one of the workers (or runs it right away if
+	// the pool has none). Jobs can't throw
+	void Push(std::function<void()> job);
+
+	// Blocks until every job pushed so far has finished. Can't be called
+	// from a job
+	void Wait();
+
+	~JobGroup() {
+		Wait();
+	}
+};
+
+} // namespace azu
+
+#endif // UTIL_THREAD_POOL_H
@@ -8,10 +8,12 @@ VkContext::~VkContext() {
 	// if the VkInstance is set to nullptr, it's probably a VkContext left in an
 	// invalid state after being moved, so the destructor shouldn't run
 	if (Instance) {
-		vkWaitForFences(Device, 1, &RenderFence, true, 1000000000);
+		// wait for every frame in flight to finish before destroying anything
+		vkDeviceWaitIdle(Device);
 
-		// unmap quads buffer memory before destroying it
-		vmaUnmapMemory(Allocator, QuadsBuffer.Allocation);
+		for (FrameData &frame : Frames) {
+			frame.DeletionQueue.flush(*this);
+		}
 
 		DeletionQueue.flush(*this);
 
@@ -6,25 +6,54 @@
 #include "../util/util.h"
 #include "../vk_init/vk_init.h"
 #include "../vk_pipeline/vk_pipeline.h"
+#include "shaders.h"
 #include "VkBootstrap.h"
 #include <SDL_vulkan.h>
-#include <cstdio>
 
 using namespace azu;
 
 VkContext::VkContext(SDL_Window *window, VkExtent2D windowExtent,
-                     bool useValidationLayers) {
-	WindowExtent = windowExtent;
+                     bool useValidationLayers, uint32_t framesInFlight,
+                     VkPresentModeKHR presentMode,
+                     uint32_t minSwapchainImageCount,
+                     bool useDepthBuffer,
+                     const char *pipelineCacheDirectory) {
+	ASSERT(framesInFlight > 0, "At least one frame in flight is needed");
+
+	Headless                      = window == nullptr;
+	WindowExtent                  = windowExtent;
+	Frames                        = std::vector<FrameData>(framesInFlight);
+	DesiredPresentMode            = presentMode;
+	DesiredMinSwapchainImageCount = minSwapchainImageCount;
 
 	_initVulkan(window, useValidationLayers);
-	_initSwapchain();
+
+	// the depth buffer only saves work, so it's left out if the GPU can't
+	// render into DEPTH_FORMAT
+	VkFormatProperties depthFormatProperties;
+	vkGetPhysicalDeviceFormatProperties(chosenGPU, DEPTH_FORMAT,
+	                                    &depthFormatProperties);
+	UseDepthBuffer = useDepthBuffer &&
+	                 (depthFormatProperties.optimalTilingFeatures &
+	                  VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+
+	if (Headless) {
+		_initOffscreenImage();
+	} else {
+		_initSwapchain();
+	}
 	_initDefaultRenderpass();
 	_initFramebuffers();
 	_initCommands();
 	_initSyncStructures();
+	_initTransfer();
 	_initDescriptors();
 	_initSampler();
+	_initPipelineCache(pipelineCacheDirectory);
 	_initPipelines();
+
+	// everything that's ever compiled is compiled by now
+	SavePipelineCache();
 }
 
 void VkContext::_initVulkan(SDL_Window *window, bool useValidationLayers) {
@@ -34,6 +63,8 @@ void VkContext::_initVulkan(SDL_Window *window, bool useValidationLayers) {
 	                             .request_validation_layers(useValidationLayers)
 	                             .use_default_debug_messenger()
 	                             .require_api_version(1, 3, 0)
+	                             // no surface extensions without a window
+	                             .set_headless(Headless)
 	                             .build();
 	if (!vkbInstanceResult) {
 		throw vkbInstanceResult.error();
@@ -44,30 +75,55 @@ void VkContext::_initVulkan(SDL_Window *window, bool useValidationLayers) {
 	Instance       = vkbInstance.instance;
 	DebugMessenger = vkbInstance.debug_messenger;
 
-	SDL_Vulkan_CreateSurface(window, Instance, &Surface);
-
 	vkb::PhysicalDeviceSelector selector{vkbInstance};
-	auto physicalDeviceResult =
-	    selector.set_minimum_version(1, 3).set_surface(Surface).select();
+	selector.set_minimum_version(1, 3);
+
+	if (!Headless) {
+		SDL_Vulkan_CreateSurface(window, Instance, &Surface);
+		selector.set_surface(Surface);
+	}
+
+	auto physicalDeviceResult = selector.select();
 	if (!physicalDeviceResult) {
 		throw physicalDeviceResult.error();
 	}
 
 	vkb::PhysicalDevice physicalDevice = physicalDeviceResult.value();
 
+	// block compressed textures are optional, so the feature is only
+	// enabled if it's there instead of being required
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice.physical_device,
+	                            &supportedFeatures);
+	physicalDevice.features.textureCompressionBC =
+	    supportedFeatures.textureCompressionBC;
+
+	// lets VMA report how much memory the driver actually lets this process
+	// use, instead of guessing from the heap sizes
+	bool memoryBudget = physicalDevice.enable_extension_if_present(
+	    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
 	vkb::DeviceBuilder deviceBuilder{physicalDevice};
 
-	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
-	indexingFeatures.sType =
-	    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
-	indexingFeatures.shaderSampledImageArrayNonUniformIndexing =
+	// the descriptor indexing features are part of the Vulkan 1.2 features
+	// struct, which can't be chained together with the separate
+	// VkPhysicalDeviceDescriptorIndexingFeatures struct
+	VkPhysicalDeviceVulkan12Features features12{};
+	features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	features12.shaderSampledImageArrayNonUniformIndexing =
 	    VK_TRUE; // can index into descriptor arrays with a uniform in shader
-	indexingFeatures.runtimeDescriptorArray =
+	features12.runtimeDescriptorArray =
 	    VK_TRUE; // can have descriptor arrays with dynamic size in shader
-	indexingFeatures.descriptorBindingPartiallyBound =
+	features12.descriptorBindingPartiallyBound =
 	    VK_TRUE; // don't need to update unused descriptors
-
-	auto vkbDeviceResult = deviceBuilder.add_pNext(&indexingFeatures).build();
+	features12.descriptorBindingSampledImageUpdateAfterBind =
+	    VK_TRUE; // can write texture descriptors while the set is bound
+	features12.descriptorBindingUpdateUnusedWhilePending =
+	    VK_TRUE; // ... and while frames using the set are still in flight
+	features12.timelineSemaphore =
+	    VK_TRUE; // used to track when texture uploads have finished
+
+	auto vkbDeviceResult = deviceBuilder.add_pNext(&features12).build();
 	if (!vkbDeviceResult) {
 		throw vkbDeviceResult.error();
 	}
@@ -77,6 +133,9 @@ void VkContext::_initVulkan(SDL_Window *window, bool useValidationLayers) {
 	Device    = vkbDevice.device;
 	chosenGPU = physicalDevice.physical_device;
 
+	vkGetPhysicalDeviceProperties(chosenGPU, &GPUProperties);
+	EnabledFeatures = physicalDevice.features;
+
 	auto graphicsQueueResult = vkbDevice.get_queue(vkb::QueueType::graphics);
 	if (!graphicsQueueResult) {
 		throw graphicsQueueResult.error();
@@ -91,6 +150,48 @@ void VkContext::_initVulkan(SDL_Window *window, bool useValidationLayers) {
 	GraphicsQueue       = graphicsQueueResult.value();
 	GraphicsQueueFamily = graphicsQueueFamilyResult.value();
 
+	// uploads go to a dedicated transfer queue if there is one (usually backed
+	// by the DMA engine on discrete GPUs), otherwise to any queue that isn't
+	// the graphics queue, and as a last resort to the graphics queue itself
+	auto dedicatedQueueResult =
+	    vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+	auto dedicatedQueueFamilyResult =
+	    vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer);
+
+	auto separateQueueResult = vkbDevice.get_queue(vkb::QueueType::transfer);
+	auto separateQueueFamilyResult =
+	    vkbDevice.get_queue_index(vkb::QueueType::transfer);
+
+	// Atlas entries are copied into pages at any texel offset, which a queue
+	// family only allows if its image transfer granularity is (1, 1, 1).
+	// Graphics families always have that, transfer-only ones might not
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(chosenGPU, &queueFamilyCount,
+	                                         nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(chosenGPU, &queueFamilyCount,
+	                                         queueFamilies.data());
+
+	auto copiesAnyRegion = [&](uint32_t family) {
+		VkExtent3D granularity =
+		    queueFamilies[family].minImageTransferGranularity;
+		return granularity.width == 1 && granularity.height == 1 &&
+		       granularity.depth == 1;
+	};
+
+	if (dedicatedQueueResult && dedicatedQueueFamilyResult &&
+	    copiesAnyRegion(dedicatedQueueFamilyResult.value())) {
+		TransferQueue       = dedicatedQueueResult.value();
+		TransferQueueFamily = dedicatedQueueFamilyResult.value();
+	} else if (separateQueueResult && separateQueueFamilyResult &&
+	           copiesAnyRegion(separateQueueFamilyResult.value())) {
+		TransferQueue       = separateQueueResult.value();
+		TransferQueueFamily = separateQueueFamilyResult.value();
+	} else {
+		TransferQueue       = GraphicsQueue;
+		TransferQueueFamily = GraphicsQueueFamily;
+	}
+
 	// MEMORY ALLOCATOR
 	// ----------------
 
@@ -98,34 +199,113 @@ void VkContext::_initVulkan(SDL_Window *window, bool useValidationLayers) {
 	allocatorInfo.physicalDevice         = chosenGPU;
 	allocatorInfo.device                 = Device;
 	allocatorInfo.instance               = Instance;
+	allocatorInfo.vulkanApiVersion       = VK_API_VERSION_1_3;
+	if (memoryBudget) {
+		allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+	}
 	VK_CHECK(vmaCreateAllocator(&allocatorInfo, &Allocator));
 
 	DeletionQueue.pushFunction(
 	    [](const VkContext &ctx) { vmaDestroyAllocator(ctx.Allocator); });
 }
 
-void VkContext::_initSwapchain() {
+void VkContext::_createSwapchain() {
 	vkb::SwapchainBuilder vkbSwapchainBuilder{chosenGPU, Device, Surface};
 
-	vkb::Swapchain vkbSwapchain =
-	    vkbSwapchainBuilder
-	        .use_default_format_selection()
-	        // use vsync present mode
-	        .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-	        .set_desired_extent(WindowExtent.width, WindowExtent.height)
-	        .build()
-	        .value();
+	vkbSwapchainBuilder.use_default_format_selection()
+	    .set_desired_present_mode(DesiredPresentMode)
+	    .set_desired_extent(WindowExtent.width, WindowExtent.height);
+
+	// if the surface doesn't support the desired present mode, fall back to
+	// the closest one that it does support. FIFO is always supported so it's
+	// the last resort for everything
+	switch (DesiredPresentMode) {
+	case VK_PRESENT_MODE_MAILBOX_KHR:
+		vkbSwapchainBuilder.add_fallback_present_mode(
+		    VK_PRESENT_MODE_IMMEDIATE_KHR);
+		break;
+	case VK_PRESENT_MODE_IMMEDIATE_KHR:
+		vkbSwapchainBuilder.add_fallback_present_mode(
+		    VK_PRESENT_MODE_MAILBOX_KHR);
+		break;
+	default:
+		break;
+	}
+	vkbSwapchainBuilder.add_fallback_present_mode(VK_PRESENT_MODE_FIFO_KHR);
+
+	// 0 means the driver's minimum is fine
+	if (DesiredMinSwapchainImageCount > 0) {
+		vkbSwapchainBuilder.set_desired_min_image_count(
+		    DesiredMinSwapchainImageCount);
+	}
+
+	auto vkbSwapchainResult = vkbSwapchainBuilder.build();
+	if (!vkbSwapchainResult) {
+		throw vkbSwapchainResult.error();
+	}
+
+	vkb::Swapchain vkbSwapchain = vkbSwapchainResult.value();
 
 	Swapchain            = vkbSwapchain.swapchain;
 	SwapchainImages      = vkbSwapchain.get_images().value();
 	SwapchainImageViews  = vkbSwapchain.get_image_views().value();
 	SwapchainImageFormat = vkbSwapchain.image_format;
+	PresentMode          = vkbSwapchain.present_mode;
+}
+
+void VkContext::_initSwapchain() {
+	_createSwapchain();
 
 	DeletionQueue.pushFunction([](const VkContext &ctx) {
 		vkDestroySwapchainKHR(ctx.Device, ctx.Swapchain, nullptr);
 	});
 }
 
+void VkContext::_initOffscreenImage() {
+	// In headless mode a single offscreen image takes the place of the
+	// swapchain. It's put into SwapchainImages/SwapchainImageViews so that the
+	// render pass and framebuffer code doesn't have to care which mode it's in
+	// (this also means its image view gets destroyed along with the
+	// framebuffers, not here)
+
+	VkExtent3D imageExtent = {WindowExtent.width, WindowExtent.height, 1};
+
+	VkImageCreateInfo imageInfo = vk_init::imageCreateInfo(
+	    OFFSCREEN_IMAGE_FORMAT,
+	    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+	    imageExtent);
+
+	VmaAllocationCreateInfo imageAllocateInfo = {};
+	imageAllocateInfo.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	VkImage image;
+	VK_CHECK(vmaCreateImage(Allocator, &imageInfo, &imageAllocateInfo, &image,
+	                        &OffscreenImageAllocation, nullptr));
+
+	VkImageViewCreateInfo imageViewInfo{};
+	imageViewInfo.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	imageViewInfo.image    = image;
+	imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	imageViewInfo.format   = OFFSCREEN_IMAGE_FORMAT;
+	imageViewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageViewInfo.subresourceRange.baseMipLevel   = 0;
+	imageViewInfo.subresourceRange.levelCount     = 1;
+	imageViewInfo.subresourceRange.baseArrayLayer = 0;
+	imageViewInfo.subresourceRange.layerCount     = 1;
+
+	VkImageView imageView;
+	VK_CHECK(vkCreateImageView(Device, &imageViewInfo, nullptr, &imageView));
+
+	SwapchainImages      = {image};
+	SwapchainImageViews  = {imageView};
+	SwapchainImageFormat = OFFSCREEN_IMAGE_FORMAT;
+
+	DeletionQueue.pushFunction([](const VkContext &ctx) {
+		vmaDestroyImage(ctx.Allocator, ctx.SwapchainImages[0],
+		                ctx.OffscreenImageAllocation);
+	});
+}
+
 void VkContext::_initDefaultRenderpass() {
 	// COLOR ATTACHMENT
 	// ----------------
@@ -140,10 +320,35 @@ void VkContext::_initDefaultRenderpass() {
 	colorAttachment.initialLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
 	colorAttachment.finalLayout             = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
+	// the offscreen image is never presented, but it can be copied out of
+	if (Headless) {
+		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	}
+
 	VkAttachmentReference colorAttachmentRef = {};
 	colorAttachmentRef.attachment            = 0;
 	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+	// DEPTH ATTACHMENT
+	// ----------------
+
+	// only needed while rendering, so it's never stored
+	VkAttachmentDescription depthAttachment = {};
+	depthAttachment.format                  = DEPTH_FORMAT;
+	depthAttachment.samples                 = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.loadOp                  = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp                 = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.stencilLoadOp           = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp          = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout =
+	    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference depthAttachmentRef = {};
+	depthAttachmentRef.attachment            = 1;
+	depthAttachmentRef.layout =
+	    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
 	// SUBPASS
 	// -------
 
@@ -151,6 +356,9 @@ void VkContext::_initDefaultRenderpass() {
 	subpass.pipelineBindPoint    = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments    = &colorAttachmentRef;
+	if (UseDepthBuffer) {
+		subpass.pDepthStencilAttachment = &depthAttachmentRef;
+	}
 
 	VkSubpassDependency dependency = {};
 	dependency.srcSubpass          = VK_SUBPASS_EXTERNAL;
@@ -160,17 +368,45 @@ void VkContext::_initDefaultRenderpass() {
 	dependency.dstStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+	// every frame in flight renders into the same offscreen image, so
+	// rendering has to wait for the previous frame's writes to it
+	if (Headless) {
+		dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	}
+
+	// there's a single depth image too, so clearing it has to wait for the
+	// previous frame's depth tests
+	VkSubpassDependency depthDependency = {};
+	depthDependency.srcSubpass          = VK_SUBPASS_EXTERNAL;
+	depthDependency.dstSubpass          = 0;
+	depthDependency.srcStageMask =
+	    VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+	    VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	depthDependency.srcAccessMask =
+	    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depthDependency.dstStageMask =
+	    VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+	    VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	depthDependency.dstAccessMask =
+	    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+	    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	VkAttachmentDescription attachments[] = {colorAttachment,
+	                                         depthAttachment};
+	VkSubpassDependency dependencies[]    = {dependency, depthDependency};
+	uint32_t attachmentCount              = UseDepthBuffer ? 2 : 1;
+
 	// CREATE RENDERPASS
 	// -----------------
 
 	VkRenderPassCreateInfo renderPassInfo = {};
 	renderPassInfo.sType           = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 1;
-	renderPassInfo.pAttachments    = &colorAttachment;
+	renderPassInfo.attachmentCount = attachmentCount;
+	renderPassInfo.pAttachments    = attachments;
 	renderPassInfo.subpassCount    = 1;
 	renderPassInfo.pSubpasses      = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies   = &dependency;
+	renderPassInfo.dependencyCount = UseDepthBuffer ? 2 : 1;
+	renderPassInfo.pDependencies   = dependencies;
 
 	VK_CHECK(vkCreateRenderPass(Device, &renderPassInfo, nullptr, &RenderPass));
 
@@ -179,43 +415,98 @@ void VkContext::_initDefaultRenderpass() {
 	});
 }
 
-void VkContext::_initFramebuffers() {
+void VkContext::_createDepthImage() {
+	VkExtent3D imageExtent = {WindowExtent.width, WindowExtent.height, 1};
+
+	VkImageCreateInfo imageInfo = vk_init::imageCreateInfo(
+	    DEPTH_FORMAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, imageExtent);
+
+	VmaAllocationCreateInfo imageAllocateInfo = {};
+	imageAllocateInfo.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	VK_CHECK(vmaCreateImage(Allocator, &imageInfo, &imageAllocateInfo,
+	                        &DepthImage, &DepthImageAllocation, nullptr));
+
+	VkImageViewCreateInfo imageViewInfo{};
+	imageViewInfo.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	imageViewInfo.image    = DepthImage;
+	imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	imageViewInfo.format   = DEPTH_FORMAT;
+	imageViewInfo.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_DEPTH_BIT;
+	imageViewInfo.subresourceRange.baseMipLevel   = 0;
+	imageViewInfo.subresourceRange.levelCount     = 1;
+	imageViewInfo.subresourceRange.baseArrayLayer = 0;
+	imageViewInfo.subresourceRange.layerCount     = 1;
+
+	VK_CHECK(
+	    vkCreateImageView(Device, &imageViewInfo, nullptr, &DepthImageView));
+}
+
+void VkContext::_destroyDepthImage() const {
+	vkDestroyImageView(Device, DepthImageView, nullptr);
+	vmaDestroyImage(Allocator, DepthImage, DepthImageAllocation);
+}
+
+void VkContext::_createFramebuffers() {
+	// the depth image has the size of the swapchain, so it's recreated along
+	// with the framebuffers. Every framebuffer shares it, frames in flight
+	// are kept apart by the render pass' dependencies
+	if (UseDepthBuffer) {
+		_createDepthImage();
+	}
+
 	VkFramebufferCreateInfo framebufferInfo =
 	    vk_init::framebufferCreateInfo(RenderPass, WindowExtent);
+	framebufferInfo.attachmentCount = UseDepthBuffer ? 2 : 1;
 
 	const uint32_t swapchainImageCount = (uint32_t)SwapchainImages.size();
 	Framebuffers = std::vector<VkFramebuffer>(swapchainImageCount);
 
 	for (uint32_t i = 0; i < swapchainImageCount; i++) {
-		framebufferInfo.pAttachments = &SwapchainImageViews[i];
+		VkImageView attachments[] = {SwapchainImageViews[i], DepthImageView};
+		framebufferInfo.pAttachments = attachments;
 		VK_CHECK(vkCreateFramebuffer(Device, &framebufferInfo, nullptr,
 		                             &Framebuffers[i]));
 	}
+}
+
+void VkContext::_initFramebuffers() {
+	_createFramebuffers();
 
 	DeletionQueue.pushFunction([](const VkContext &ctx) {
 		for (uint32_t i = 0; i < ctx.Framebuffers.size(); i++) {
 			vkDestroyFramebuffer(ctx.Device, ctx.Framebuffers[i], nullptr);
 			vkDestroyImageView(ctx.Device, ctx.SwapchainImageViews[i], nullptr);
 		}
+
+		if (ctx.UseDepthBuffer) {
+			ctx._destroyDepthImage();
+		}
 	});
 }
 
 void VkContext::_initCommands() {
+	// every frame in flight gets its own command pool, so that resetting one
+	// frame's command buffer never touches a buffer the GPU is still executing
+
 	VkCommandPoolCreateInfo commandPoolInfo = vk_init::commandPoolCreateInfo(
 	    GraphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-	VK_CHECK(
-	    vkCreateCommandPool(Device, &commandPoolInfo, nullptr, &CommandPool));
+	for (uint32_t i = 0; i < Frames.size(); i++) {
+		VK_CHECK(vkCreateCommandPool(Device, &commandPoolInfo, nullptr,
+		                             &Frames[i].CommandPool));
 
-	VkCommandBufferAllocateInfo cmdAllocInfo =
-	    vk_init::commandBufferAllocateInfo(CommandPool, 1);
+		VkCommandBufferAllocateInfo cmdAllocInfo =
+		    vk_init::commandBufferAllocateInfo(Frames[i].CommandPool, 1);
 
-	VK_CHECK(
-	    vkAllocateCommandBuffers(Device, &cmdAllocInfo, &MainCommandBuffer));
+		VK_CHECK(vkAllocateCommandBuffers(Device, &cmdAllocInfo,
+		                                  &Frames[i].MainCommandBuffer));
 
-	DeletionQueue.pushFunction([](const VkContext &ctx) {
-		vkDestroyCommandPool(ctx.Device, ctx.CommandPool, nullptr);
-	});
+		DeletionQueue.pushFunction([i](const VkContext &ctx) {
+			vkDestroyCommandPool(ctx.Device, ctx.Frames[i].CommandPool,
+			                     nullptr);
+		});
+	}
 
 	// also a command pool and command buffer for the immediateSubmit function
 
@@ -238,30 +529,33 @@ void VkContext::_initCommands() {
 }
 
 void VkContext::_initSyncStructures() {
-	// one fence to control when the gpu has finished rendering the frame, and 2
-	// semaphores to syncronize rendering with swapchain the fence starts
-	// signaled so I can wait on it on the first frame
+	// for every frame in flight: one fence to control when the gpu has
+	// finished rendering that frame, and 2 semaphores to syncronize rendering
+	// with swapchain. The fences start signaled so I can wait on them on the
+	// first few frames
 
 	VkFenceCreateInfo fenceCreateInfo =
 	    vk_init::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
 
-	VK_CHECK(vkCreateFence(Device, &fenceCreateInfo, nullptr, &RenderFence));
-
-	DeletionQueue.pushFunction([](const VkContext &ctx) {
-		vkDestroyFence(ctx.Device, ctx.RenderFence, nullptr);
-	});
-
 	VkSemaphoreCreateInfo semaphoreCreateInfo = vk_init::semaphoreCreateInfo();
 
-	VK_CHECK(vkCreateSemaphore(Device, &semaphoreCreateInfo, nullptr,
-	                           &PresentSemaphore));
-	VK_CHECK(vkCreateSemaphore(Device, &semaphoreCreateInfo, nullptr,
-	                           &RenderSemaphore));
-
-	DeletionQueue.pushFunction([](const VkContext &ctx) {
-		vkDestroySemaphore(ctx.Device, ctx.PresentSemaphore, nullptr);
-		vkDestroySemaphore(ctx.Device, ctx.RenderSemaphore, nullptr);
-	});
+	for (uint32_t i = 0; i < Frames.size(); i++) {
+		VK_CHECK(vkCreateFence(Device, &fenceCreateInfo, nullptr,
+		                       &Frames[i].RenderFence));
+
+		VK_CHECK(vkCreateSemaphore(Device, &semaphoreCreateInfo, nullptr,
+		                           &Frames[i].PresentSemaphore));
+		VK_CHECK(vkCreateSemaphore(Device, &semaphoreCreateInfo, nullptr,
+		                           &Frames[i].RenderSemaphore));
+
+		DeletionQueue.pushFunction([i](const VkContext &ctx) {
+			vkDestroyFence(ctx.Device, ctx.Frames[i].RenderFence, nullptr);
+			vkDestroySemaphore(ctx.Device, ctx.Frames[i].PresentSemaphore,
+			                   nullptr);
+			vkDestroySemaphore(ctx.Device, ctx.Frames[i].RenderSemaphore,
+			                   nullptr);
+		});
+	}
 
 	// also a fence for the immedateSubmit function
 
@@ -275,19 +569,23 @@ void VkContext::_initSyncStructures() {
 }
 
 void VkContext::_initDescriptors() {
+	const uint32_t framesInFlight = (uint32_t)Frames.size();
+
 	// CREATE DESCRIPTOR POOL
 	// ----------------------
 
+	// every frame has a set for its quads buffer, one for its culled sprites
+	// buffer and one with the three buffers for culling the sprites
 	std::vector<VkDescriptorPoolSize> sizes = {
-	    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         10},
+	    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         6 * framesInFlight},
 	    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-	     INITIAL_ARRAY_OF_TEXTURES_LENGTH             }
+	     INITIAL_ARRAY_OF_TEXTURES_LENGTH                              }
     };
 
 	VkDescriptorPoolCreateInfo pool_info = {};
 	pool_info.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	pool_info.flags         = 0;
-	pool_info.maxSets       = 10;
+	pool_info.flags         = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	pool_info.maxSets       = 3 * framesInFlight + 1;
 	pool_info.poolSizeCount = (uint32_t)sizes.size();
 	pool_info.pPoolSizes    = sizes.data();
 
@@ -298,8 +596,8 @@ void VkContext::_initDescriptors() {
 		vkDestroyDescriptorPool(ctx.Device, ctx.GlobalDescriptorPool, nullptr);
 	});
 
-	// CREATE DESCRIPTOR SET LAYOUT
-	// ----------------------------
+	// CREATE PER-FRAME DESCRIPTOR SET LAYOUT (set 0)
+	// ----------------------------------------------
 
 	VkDescriptorSetLayoutBinding quadsBufferBinding = {};
 	quadsBufferBinding.binding                      = 0;
@@ -307,32 +605,81 @@ void VkContext::_initDescriptors() {
 	quadsBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	quadsBufferBinding.stageFlags     = VK_SHADER_STAGE_VERTEX_BIT;
 
+	VkDescriptorSetLayoutCreateInfo frameLayoutInfo = {};
+	frameLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	frameLayoutInfo.pNext = nullptr;
+	frameLayoutInfo.bindingCount = 1;
+	frameLayoutInfo.pBindings    = &quadsBufferBinding;
+	frameLayoutInfo.flags        = 0;
+
+	VK_CHECK(vkCreateDescriptorSetLayout(Device, &frameLayoutInfo, nullptr,
+	                                     &FrameDescriptorSetLayout));
+
+	DeletionQueue.pushFunction([](const VkContext &ctx) {
+		vkDestroyDescriptorSetLayout(ctx.Device, ctx.FrameDescriptorSetLayout,
+		                             nullptr);
+	});
+
+	// CREATE SPRITE CULLING DESCRIPTOR SET LAYOUT
+	// -------------------------------------------
+
+	// the sprites, culled sprites, batches and tiles buffers, see
+	// cull_sprites.comp
+	VkDescriptorSetLayoutBinding cullBindings[4];
+	for (uint32_t i = 0; i < 4; i++) {
+		cullBindings[i]                    = {};
+		cullBindings[i].binding            = i;
+		cullBindings[i].descriptorCount    = 1;
+		cullBindings[i].descriptorType     = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		cullBindings[i].stageFlags         = VK_SHADER_STAGE_COMPUTE_BIT;
+		cullBindings[i].pImmutableSamplers = nullptr;
+	}
+
+	VkDescriptorSetLayoutCreateInfo cullLayoutInfo = {};
+	cullLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	cullLayoutInfo.pNext = nullptr;
+	cullLayoutInfo.bindingCount = 4;
+	cullLayoutInfo.pBindings    = cullBindings;
+	cullLayoutInfo.flags        = 0;
+
+	VK_CHECK(vkCreateDescriptorSetLayout(Device, &cullLayoutInfo, nullptr,
+	                                     &SpriteCullDescriptorSetLayout));
+
+	DeletionQueue.pushFunction([](const VkContext &ctx) {
+		vkDestroyDescriptorSetLayout(
+		    ctx.Device, ctx.SpriteCullDescriptorSetLayout, nullptr);
+	});
+
+	// CREATE GLOBAL DESCRIPTOR SET LAYOUT (set 1)
+	// -------------------------------------------
+
 	VkDescriptorSetLayoutBinding texturesBinding = {};
-	texturesBinding.binding                      = 1;
+	texturesBinding.binding                      = 0;
 	texturesBinding.descriptorCount = INITIAL_ARRAY_OF_TEXTURES_LENGTH;
 	texturesBinding.descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	texturesBinding.stageFlags      = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	VkDescriptorSetLayoutBinding bindings[] = {quadsBufferBinding,
-	                                           texturesBinding};
-
-	VkDescriptorBindingFlags flags[2];
-	flags[0] = 0;
-	flags[1] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+	// textures are registered one slot at a time while frames that use the
+	// set are in flight, which needs the update after bind flags
+	VkDescriptorBindingFlags flags[1];
+	flags[0] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+	           VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+	           VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
 
 	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT extendedInfo{};
 	extendedInfo.sType =
 	    VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
 	extendedInfo.pNext         = nullptr;
-	extendedInfo.bindingCount  = 2;
+	extendedInfo.bindingCount  = 1;
 	extendedInfo.pBindingFlags = flags;
 
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	layoutInfo.pNext = nullptr;
-	layoutInfo.bindingCount = 2;
-	layoutInfo.pBindings    = bindings;
-	layoutInfo.flags        = 0;
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings    = &texturesBinding;
+	layoutInfo.flags =
+	    VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
 	layoutInfo.pNext        = &extendedInfo;
 
 	VK_CHECK(vkCreateDescriptorSetLayout(Device, &layoutInfo, nullptr,
@@ -343,20 +690,8 @@ void VkContext::_initDescriptors() {
 		                             nullptr);
 	});
 
-	// CREATE QUADS BUFFER
-	// -------------------
-
-	QuadsBuffer =
-	    Buffer(Allocator, INITIAL_QUADS_BUFFER_SIZE,
-	           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-	DeletionQueue.pushFunction([](const VkContext &ctx) {
-		vmaDestroyBuffer(ctx.Allocator, ctx.QuadsBuffer.VulkanBuffer,
-		                 ctx.QuadsBuffer.Allocation);
-	});
-
-	// ALLOCATE DESCRIPTOR SET
-	// -----------------------
+	// ALLOCATE GLOBAL DESCRIPTOR SET
+	// ------------------------------
 
 	VkDescriptorSetAllocateInfo allocateInfo = {};
 	allocateInfo.pNext                       = nullptr;
@@ -368,30 +703,103 @@ void VkContext::_initDescriptors() {
 	VK_CHECK(
 	    vkAllocateDescriptorSets(Device, &allocateInfo, &GlobalDescriptorSet));
 
-	// UPDATE DESCRIPTOR SET TO POINT TO QUADS BUFFER
-	// ----------------------------------------------
+	DeletionQueue.pushFunction([](const VkContext &ctx) {
+		if (ctx.SpritesBuffer) {
+			vmaDestroyBuffer(ctx.Allocator, ctx.SpritesBuffer,
+			                 ctx.SpritesBufferAllocation);
+		}
+	});
 
-	VkDescriptorBufferInfo descriptorBufferInfo;
-	descriptorBufferInfo.buffer = QuadsBuffer.VulkanBuffer;
-	descriptorBufferInfo.offset = 0;
-	descriptorBufferInfo.range  = INITIAL_QUADS_BUFFER_SIZE;
-
-	VkWriteDescriptorSet setWriteBuffer = {};
-	setWriteBuffer.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	setWriteBuffer.pNext           = nullptr;
-	setWriteBuffer.dstBinding      = 0;
-	setWriteBuffer.dstSet          = GlobalDescriptorSet;
-	setWriteBuffer.descriptorCount = 1;
-	setWriteBuffer.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	setWriteBuffer.pBufferInfo     = &descriptorBufferInfo;
-
-	vkUpdateDescriptorSets(Device, 1, &setWriteBuffer, 0, nullptr);
+	// CREATE PER-FRAME QUADS BUFFERS AND DESCRIPTOR SETS
+	// --------------------------------------------------
+
+	for (uint32_t i = 0; i < framesInFlight; i++) {
+		FrameData &frame = Frames[i];
+
+		frame.QuadsBuffer = Buffer(Allocator, INITIAL_QUADS_BUFFER_SIZE,
+		                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		                           VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+		DeletionQueue.pushFunction([i](const VkContext &ctx) {
+			// unmap quads buffer memory before destroying it
+			vmaUnmapMemory(ctx.Allocator, ctx.Frames[i].QuadsBuffer.Allocation);
+			vmaDestroyBuffer(ctx.Allocator,
+			                 ctx.Frames[i].QuadsBuffer.VulkanBuffer,
+			                 ctx.Frames[i].QuadsBuffer.Allocation);
+		});
+
+		VkDescriptorSetAllocateInfo frameAllocateInfo = {};
+		frameAllocateInfo.pNext                       = nullptr;
+		frameAllocateInfo.sType =
+		    VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		frameAllocateInfo.descriptorPool     = GlobalDescriptorPool;
+		frameAllocateInfo.descriptorSetCount = 1;
+		frameAllocateInfo.pSetLayouts        = &FrameDescriptorSetLayout;
+
+		VK_CHECK(vkAllocateDescriptorSets(Device, &frameAllocateInfo,
+		                                  &frame.QuadsDescriptorSet));
+
+		// only pointed at the sprites buffer once there is one, see
+		// GetSpritesDescriptorSet
+		VK_CHECK(vkAllocateDescriptorSets(Device, &frameAllocateInfo,
+		                                  &frame.SpritesDescriptorSet));
+
+		// only pointed at its buffers once they exist, see CullSprites
+		VkDescriptorSetAllocateInfo cullAllocateInfo = frameAllocateInfo;
+		cullAllocateInfo.pSetLayouts = &SpriteCullDescriptorSetLayout;
+
+		VK_CHECK(vkAllocateDescriptorSets(Device, &cullAllocateInfo,
+		                                  &frame.SpriteCullDescriptorSet));
+
+		DeletionQueue.pushFunction([i](const VkContext &ctx) {
+			const FrameData &frame = ctx.Frames[i];
+
+			for (const Buffer *buffer : {&frame.SpritesStagingBuffer,
+			                             &frame.SpriteCullBatchesBuffer,
+			                             &frame.SpriteCullTilesBuffer}) {
+				if (buffer->Size > 0) {
+					vmaUnmapMemory(ctx.Allocator, buffer->Allocation);
+					vmaDestroyBuffer(ctx.Allocator, buffer->VulkanBuffer,
+					                 buffer->Allocation);
+				}
+			}
+
+			if (frame.CulledSpritesBuffer) {
+				vmaDestroyBuffer(ctx.Allocator, frame.CulledSpritesBuffer,
+				                 frame.CulledSpritesBufferAllocation);
+			}
+		});
+
+		// point the frame's descriptor set to its quads buffer
+		VkDescriptorBufferInfo descriptorBufferInfo;
+		descriptorBufferInfo.buffer = frame.QuadsBuffer.VulkanBuffer;
+		descriptorBufferInfo.offset = 0;
+		descriptorBufferInfo.range  = INITIAL_QUADS_BUFFER_SIZE;
+
+		VkWriteDescriptorSet setWriteBuffer = {};
+		setWriteBuffer.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		setWriteBuffer.pNext           = nullptr;
+		setWriteBuffer.dstBinding      = 0;
+		setWriteBuffer.dstSet          = frame.QuadsDescriptorSet;
+		setWriteBuffer.descriptorCount = 1;
+		setWriteBuffer.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		setWriteBuffer.pBufferInfo     = &descriptorBufferInfo;
+
+		vkUpdateDescriptorSets(Device, 1, &setWriteBuffer, 0, nullptr);
+	}
 }
 
 void VkContext::_initSampler() {
 	VkSamplerCreateInfo samplerInfo = vk_init::samplerCreateInfo(
 	    VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_REPEAT);
 
+	// magnified textures keep their sharp pixels, minified ones are filtered
+	// trilinearly across the mip chain (if they have one)
+	samplerInfo.minFilter  = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.minLod     = 0.0f;
+	samplerInfo.maxLod     = VK_LOD_CLAMP_NONE;
+
 	VK_CHECK(vkCreateSampler(Device, &samplerInfo, nullptr, &GlobalSampler));
 
 	DeletionQueue.pushFunction([](const VkContext &ctx) {
@@ -403,33 +811,18 @@ void VkContext::_initPipelines() {
 	// BUILD SHADERS
 	// -------------
 
-	auto triangleFragShader =
-	    _loadShaderModuleFromFile("./shaders/quad.frag.spv");
-
-	if (!triangleFragShader) {
-		printf("FAILED to build quad fragment shader.\n");
-		return;
-	} else {
-		printf("SUCCESSFULLY built quad fragment shader.\n");
-	}
-
-	auto triangleVertShader =
-	    _loadShaderModuleFromFile("./shaders/quad.vert.spv");
-
-	if (!triangleVertShader) {
-		printf("FAILED to build quad vertex shader.\n");
-		return;
-	} else {
-		printf("SUCCESSFULLY built quad vertex shader.\n");
-	}
+	// the SPIR-V is compiled into the binary, see shaders.h
+	VkShaderModule triangleFragShader = _createShaderModule(QUAD_FRAG_SPIRV);
+	VkShaderModule triangleVertShader = _createShaderModule(QUAD_VERT_SPIRV);
 
 	// CREATE PIPELINE LAYOUT
 	// ----------------------
 
 	VkPushConstantRange pushConstantRanges[] = {
-	    {VK_SHADER_STAGE_VERTEX_BIT, 0, 4 * 4 * 4}
+	    {VK_SHADER_STAGE_VERTEX_BIT, 0, 4 * 4 * 4 + sizeof(QuadDrawOrder)}
     };
-	VkDescriptorSetLayout descriptorSetLayouts[] = {GlobalDescriptorSetLayout};
+	VkDescriptorSetLayout descriptorSetLayouts[] = {FrameDescriptorSetLayout,
+	                                                GlobalDescriptorSetLayout};
 	VkPipelineLayoutCreateInfo pipeline_layout_info =
 	    vk_init::pipelineLayoutCreateInfo(pushConstantRanges,
 	                                      descriptorSetLayouts);
@@ -444,16 +837,17 @@ void VkContext::_initPipelines() {
 
 	pipelineBuilder.ShaderStages = {
 	    vk_init::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT,
-	                                           triangleVertShader.value()),
+	                                           triangleVertShader),
 	    vk_init::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT,
-	                                           triangleFragShader.value())};
+	                                           triangleFragShader)};
 
 	pipelineBuilder.VertexInputInfo =
 	    vk_init::pipelineVertexInputStateCreateInfo();
 
+	// every quad is drawn as an instance of a 4 vertex strip
 	pipelineBuilder.InputAssembly =
 	    vk_init::pipelineInputAssemblyStateCreateInfo(
-	        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
 
 	pipelineBuilder.Rasterizer =
 	    vk_init::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
@@ -476,19 +870,99 @@ void VkContext::_initPipelines() {
 
 	pipelineBuilder.PipelineLayout = PipelineLayout;
 
-	// finally build the pipeline
-	auto pipeline = pipelineBuilder.Build(Device, RenderPass);
-	if (pipeline) {
-		Pipeline = pipeline.value();
-	} else {
-		throw std::runtime_error("Failed to create pipeline");
+	// BUILD PIPELINE VARIANTS
+	// -----------------------
+
+	// the fragment shader's ROUNDED and TEXTURED specialization constants
+	VkSpecializationMapEntry specializationEntries[] = {
+	    {0, 0, sizeof(VkBool32)},
+	    {1, sizeof(VkBool32), sizeof(VkBool32)}
+    };
+
+	for (uint32_t flags = 0; flags < QUAD_PIPELINE_COUNT; flags++) {
+		// rounded corners always need blending for their antialiased edges
+		// (see QuadData::PipelineFlags), so these would never be used
+		bool rounded = flags & QUAD_PIPELINE_ROUNDED;
+		if (rounded && !(flags & QUAD_PIPELINE_BLENDED)) {
+			QuadPipelines[flags] = VK_NULL_HANDLE;
+			continue;
+		}
+
+		VkBool32 specializationData[] = {
+		    rounded ? VK_TRUE : VK_FALSE,
+		    (flags & QUAD_PIPELINE_TEXTURED) ? VK_TRUE : VK_FALSE};
+
+		VkSpecializationInfo specializationInfo;
+		specializationInfo.mapEntryCount = 2;
+		specializationInfo.pMapEntries   = specializationEntries;
+		specializationInfo.dataSize      = sizeof(specializationData);
+		specializationInfo.pData         = specializationData;
+
+		pipelineBuilder.ShaderStages[1].pSpecializationInfo =
+		    &specializationInfo;
+
+		// opaque quads overwrite whatever is behind them, and with a depth
+		// buffer they also hide whatever is drawn behind them later
+		bool blended = flags & QUAD_PIPELINE_BLENDED;
+		pipelineBuilder.ColorBlendAttachment.blendEnable =
+		    blended ? VK_TRUE : VK_FALSE;
+		pipelineBuilder.DepthStencil =
+		    vk_init::pipelineDepthStencilStateCreateInfo(
+		        UseDepthBuffer, UseDepthBuffer && !blended,
+		        VK_COMPARE_OP_GREATER);
+
+		auto pipeline =
+		    pipelineBuilder.Build(Device, RenderPass, PipelineCache);
+		if (pipeline) {
+			QuadPipelines[flags] = pipeline.value();
+		} else {
+			throw std::runtime_error("Failed to create pipeline");
+		}
 	}
 
-	vkDestroyShaderModule(Device, triangleFragShader.value(), nullptr);
-	vkDestroyShaderModule(Device, triangleVertShader.value(), nullptr);
+	vkDestroyShaderModule(Device, triangleFragShader, nullptr);
+	vkDestroyShaderModule(Device, triangleVertShader, nullptr);
 
 	DeletionQueue.pushFunction([](const VkContext &ctx) {
-		vkDestroyPipeline(ctx.Device, ctx.Pipeline, nullptr);
+		for (VkPipeline pipeline : ctx.QuadPipelines) {
+			vkDestroyPipeline(ctx.Device, pipeline, nullptr);
+		}
 		vkDestroyPipelineLayout(ctx.Device, ctx.PipelineLayout, nullptr);
 	});
+
+	// BUILD SPRITE CULLING PIPELINE
+	// -----------------------------
+
+	VkShaderModule cullShader = _createShaderModule(CULL_SPRITES_COMP_SPIRV);
+
+	VkPushConstantRange cullPushConstantRanges[] = {
+	    {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SpriteCullConstants)}
+    };
+	VkDescriptorSetLayout cullDescriptorSetLayouts[] = {
+	    SpriteCullDescriptorSetLayout};
+	VkPipelineLayoutCreateInfo cullLayoutInfo =
+	    vk_init::pipelineLayoutCreateInfo(cullPushConstantRanges,
+	                                      cullDescriptorSetLayouts);
+
+	VK_CHECK(vkCreatePipelineLayout(Device, &cullLayoutInfo, nullptr,
+	                                &SpriteCullPipelineLayout));
+
+	VkComputePipelineCreateInfo cullPipelineInfo = {};
+	cullPipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	cullPipelineInfo.pNext  = nullptr;
+	cullPipelineInfo.layout = SpriteCullPipelineLayout;
+	cullPipelineInfo.stage  = vk_init::pipelineShaderStageCreateInfo(
+	    VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+
+	VK_CHECK(vkCreateComputePipelines(Device, PipelineCache, 1,
+	                                  &cullPipelineInfo, nullptr,
+	                                  &SpriteCullPipeline));
+
+	vkDestroyShaderModule(Device, cullShader, nullptr);
+
+	DeletionQueue.pushFunction([](const VkContext &ctx) {
+		vkDestroyPipeline(ctx.Device, ctx.SpriteCullPipeline, nullptr);
+		vkDestroyPipelineLayout(ctx.Device, ctx.SpriteCullPipelineLayout,
+		                        nullptr);
+	});
 }
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "vk_context.h"
+
+#include "../util/util.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace azu;
+
+// Whether data was written by a driver that can read it back. Drivers are
+// supposed to reject caches that aren't theirs, but not all of them do
+// that gracefully, so it's checked before the data is handed over
+static bool isCompatiblePipelineCache(const std::vector<uint8_t> &data,
+                                      const VkPhysicalDeviceProperties &gpu) {
+	VkPipelineCacheHeaderVersionOne header;
+	if (data.size() < sizeof(header)) {
+		return false;
+	}
+
+	memcpy(&header, data.data(), sizeof(header));
+
+	return header.headerSize >= sizeof(header) &&
+	       header.headerSize <= data.size() &&
+	       header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+	       header.vendorID == gpu.vendorID &&
+	       header.deviceID == gpu.deviceID &&
+	       memcmp(header.pipelineCacheUUID, gpu.pipelineCacheUUID,
+	              VK_UUID_SIZE) == 0;
+}
+
+void VkContext::_initPipelineCache(const char *directory) {
+	std::vector<uint8_t> data;
+
+	if (directory) {
+		PipelineCachePath =
+		    (std::filesystem::path(directory) / PIPELINE_CACHE_FILE_NAME)
+		        .string();
+
+		std::ifstream file(PipelineCachePath,
+		                   std::ios::ate | std::ios::binary);
+		if (file.is_open()) {
+			data.resize((size_t)file.tellg());
+			file.seekg(0);
+			file.read((char *)data.data(), (int64_t)data.size());
+
+			// a cache from another driver (version) or GPU, it's replaced
+			// once the pipelines have been compiled again
+			if (!file || !isCompatiblePipelineCache(data, GPUProperties)) {
+				data.clear();
+			}
+		}
+	}
+
+	_loadedPipelineCacheData = data;
+
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.pNext           = nullptr;
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData    = data.empty() ? nullptr : data.data();
+
+	VK_CHECK(
+	    vkCreatePipelineCache(Device, &cacheInfo, nullptr, &PipelineCache));
+
+	DeletionQueue.pushFunction([](const VkContext &ctx) {
+		vkDestroyPipelineCache(ctx.Device, ctx.PipelineCache, nullptr);
+	});
+}
+
+void VkContext::SavePipelineCache() {
+	if (PipelineCachePath.empty()) {
+		return;
+	}
+
+	size_t size = 0;
+	VK_CHECK(vkGetPipelineCacheData(Device, PipelineCache, &size, nullptr));
+
+	std::vector<uint8_t> data(size);
+	VK_CHECK(
+	    vkGetPipelineCacheData(Device, PipelineCache, &size, data.data()));
+	data.resize(size);
+
+	// nothing new was compiled
+	if (data == _loadedPipelineCacheData) {
+		return;
+	}
+
+	// Written next to the cache and then moved over it, so another launch
+	// never reads a half written file. The suffix is random, so launches
+	// saving at the same time don't write into the same file. Failing to
+	// save only costs the next launch some compile time, so it isn't an
+	// error
+	std::filesystem::path path          = PipelineCachePath;
+	std::filesystem::path temporaryPath =
+	    path.string() + ".tmp" + std::to_string(std::random_device()());
+
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		file.write((const char *)data.data(), (int64_t)data.size());
+		if (!file) {
+			printf("FAILED to save the pipeline cache.\n");
+			file.close();
+			std::filesystem::remove(temporaryPath, error);
+			return;
+		}
+	}
+
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error) {
+		printf("FAILED to save the pipeline cache.\n");
+		std::filesystem::remove(temporaryPath, error);
+		return;
+	}
+
+	_loadedPipelineCacheData = data;
+}
@@ -1,44 +1,20 @@
 #include "vk_context.h"
 
-#include <fstream>
-#include <optional>
+#include "../util/util.h"
 
 using namespace azu;
 
-std::optional<VkShaderModule>
-VkContext::_loadShaderModuleFromFile(const char *path) const {
-	std::ifstream file(path, std::ios::ate | std::ios::binary);
-
-	if (!file.is_open()) {
-		return std::nullopt;
-	}
-
-	size_t fileSize = (size_t)file.tellg();
-
-	std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
-
-	// put file cursor at beginning
-	file.seekg(0);
-	// load the entire file into the buffer
-	file.read((char *)buffer.data(), (int64_t)fileSize);
-	// now that the file is loaded into the buffer, close it
-	file.close();
-
+VkShaderModule
+VkContext::_createShaderModule(std::span<const uint32_t> code) const {
 	VkShaderModuleCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	createInfo.pNext = nullptr;
-	createInfo.pCode = buffer.data();
-	createInfo.codeSize =
-	    buffer.size() *
-	    sizeof(uint32_t); // codeSize has to be in bytes, so multiply the ints
-	                      // in the buffer by size of int to know the real size
-	                      // of the buffer
+	createInfo.pCode = code.data();
+	// in bytes, not words
+	createInfo.codeSize = code.size_bytes();
 
 	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(Device, &createInfo, nullptr, &shaderModule) !=
-	    VK_SUCCESS) {
-		return std::nullopt;
-	}
+	VK_CHECK(vkCreateShaderModule(Device, &createInfo, nullptr, &shaderModule));
 
 	return shaderModule;
-}
\ No newline at end of file
+}
@@ -0,0 +1,26 @@
+#ifndef VK_CONTEXT_SHADERS_H
+#define VK_CONTEXT_SHADERS_H
+
+#include <cstdint>
+
+namespace azu {
+
+// The SPIR-V of every shader in shaders/, which meson compiles with glslc
+// into lists of words (see shaders/meson.build), so nothing is read from
+// disk at startup and the binary can be moved anywhere
+
+constexpr uint32_t QUAD_VERT_SPIRV[] = {
+#include "quad.vert.inc"
+};
+
+constexpr uint32_t QUAD_FRAG_SPIRV[] = {
+#include "quad.frag.inc"
+};
+
+constexpr uint32_t CULL_SPRITES_COMP_SPIRV[] = {
+#include "cull_sprites.comp.inc"
+};
+
+} // namespace azu
+
+#endif // VK_CONTEXT_SHADERS_H
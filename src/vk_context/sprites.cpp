@@ -0,0 +1,337 @@
+#include "vk_context.h"
+
+#include "../util/util.h"
+#include "../vk_init/vk_init.h"
+#include <algorithm>
+
+using namespace azu;
+
+bool VkContext::EnsureSpritesBufferCapacity(uint32_t spriteCount) {
+	uint64_t requiredSize = (uint64_t)spriteCount * sizeof(QuadData);
+	if (requiredSize <= SpritesBufferSize) {
+		return false;
+	}
+
+	uint64_t maxSize = GPUProperties.limits.maxStorageBufferRange;
+	if (requiredSize > maxSize) {
+		throw std::runtime_error("Too many sprites for the sprites buffer");
+	}
+
+	// grow geometrically, like the quads buffers
+	uint64_t newSize = std::max(SpritesBufferSize,
+	                            (uint64_t)INITIAL_SPRITES_BUFFER_SIZE);
+	while (newSize < requiredSize) {
+		newSize *= 2;
+	}
+	newSize = std::min(newSize, maxSize);
+
+	// frames in flight might still be drawing from the old buffer. They were
+	// all submitted before the current frame, so they're done by the time
+	// the current frame's slot is reused
+	if (SpritesBuffer) {
+		VkBuffer oldBuffer          = SpritesBuffer;
+		VmaAllocation oldAllocation = SpritesBufferAllocation;
+		GetCurrentFrame().DeletionQueue.pushFunction(
+		    [oldBuffer, oldAllocation](const VkContext &ctx) {
+			    vmaDestroyBuffer(ctx.Allocator, oldBuffer, oldAllocation);
+		    });
+	}
+
+	VkBufferCreateInfo bufferInfo = vk_init::bufferCreateInfo(
+	    (uint32_t)newSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+	                           VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+
+	VmaAllocationCreateInfo allocateInfo = {};
+	allocateInfo.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	VK_CHECK(vmaCreateBuffer(Allocator, &bufferInfo, &allocateInfo,
+	                         &SpritesBuffer, &SpritesBufferAllocation,
+	                         nullptr));
+	SpritesBufferSize = newSize;
+
+	return true;
+}
+
+QuadData *VkContext::StageSprites(uint32_t count) {
+	FrameData &frame = GetCurrentFrame();
+
+	uint64_t requiredSize = (uint64_t)count * sizeof(QuadData);
+	if (requiredSize > frame.SpritesStagingBuffer.Size) {
+		if (frame.SpritesStagingBuffer.Size > 0) {
+			Buffer oldBuffer = frame.SpritesStagingBuffer;
+			frame.DeletionQueue.pushFunction([oldBuffer](const VkContext &ctx) {
+				vmaUnmapMemory(ctx.Allocator, oldBuffer.Allocation);
+				vmaDestroyBuffer(ctx.Allocator, oldBuffer.VulkanBuffer,
+				                 oldBuffer.Allocation);
+			});
+		}
+
+		uint64_t newSize = std::max((uint64_t)frame.SpritesStagingBuffer.Size,
+		                            (uint64_t)INITIAL_SPRITES_BUFFER_SIZE);
+		while (newSize < requiredSize) {
+			newSize *= 2;
+		}
+
+		frame.SpritesStagingBuffer =
+		    Buffer(Allocator, (uint32_t)newSize,
+		           VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	}
+
+	return (QuadData *)frame.SpritesStagingBuffer.Data;
+}
+
+void VkContext::RecordSpritesUpload(VkCommandBuffer cmd,
+                                    std::span<const VkBufferCopy> regions) {
+	FrameData &frame = GetCurrentFrame();
+
+	VK_CHECK(vmaFlushAllocation(Allocator,
+	                            frame.SpritesStagingBuffer.Allocation, 0,
+	                            VK_WHOLE_SIZE));
+
+	// frames in flight might still be culling the sprites being overwritten
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+	                     nullptr, 0, nullptr);
+
+	vkCmdCopyBuffer(cmd, frame.SpritesStagingBuffer.VulkanBuffer,
+	                SpritesBuffer, (uint32_t)regions.size(), regions.data());
+
+	VkMemoryBarrier barrier = {};
+	barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+	                     0, nullptr, 0, nullptr);
+}
+
+// Creates a culling buffer, or replaces one that's too small for size bytes
+// with one twice as big, and returns whether it did. The frame's last use of
+// it is over, so the old one can be destroyed right away
+static bool growCullBuffer(VmaAllocator allocator, Buffer &buffer,
+                           uint64_t size, uint64_t initialSize,
+                           VkBufferUsageFlags usage) {
+	if (buffer.Size > 0 && size <= buffer.Size) {
+		return false;
+	}
+
+	uint64_t newSize = std::max((uint64_t)buffer.Size, initialSize);
+	while (newSize < size) {
+		newSize *= 2;
+	}
+
+	if (buffer.Size > 0) {
+		vmaUnmapMemory(allocator, buffer.Allocation);
+		vmaDestroyBuffer(allocator, buffer.VulkanBuffer, buffer.Allocation);
+	}
+
+	buffer = Buffer(allocator, (uint32_t)newSize,
+	                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | usage,
+	                VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+	return true;
+}
+
+void VkContext::CullSprites(VkCommandBuffer cmd,
+                            std::span<const QuadBatch> batches,
+                            float viewportWidth, float viewportHeight) {
+	FrameData &frame = GetCurrentFrame();
+
+	// This frame's last use of its buffers is over, since its RenderFence
+	// has been waited on, so they can be replaced right away. The culled
+	// sprites buffer mirrors the sprites buffer
+	if (frame.CulledSpritesBufferSize < SpritesBufferSize) {
+		if (frame.CulledSpritesBuffer) {
+			vmaDestroyBuffer(Allocator, frame.CulledSpritesBuffer,
+			                 frame.CulledSpritesBufferAllocation);
+		}
+
+		VkBufferCreateInfo bufferInfo = vk_init::bufferCreateInfo(
+		    (uint32_t)SpritesBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+		VmaAllocationCreateInfo allocateInfo = {};
+		allocateInfo.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+
+		VK_CHECK(vmaCreateBuffer(Allocator, &bufferInfo, &allocateInfo,
+		                         &frame.CulledSpritesBuffer,
+		                         &frame.CulledSpritesBufferAllocation,
+		                         nullptr));
+		frame.CulledSpritesBufferSize = SpritesBufferSize;
+
+		// the new buffer could have the old one's handle
+		frame.SpritesDescriptorBuffer     = nullptr;
+		frame.SpriteCullDescriptorBuffers = {};
+	}
+
+	// one tile per workgroup worth of sprites, see cull_sprites.comp
+	uint32_t tileCount = 0;
+	for (const QuadBatch &batch : batches) {
+		tileCount += (batch.QuadCount + SPRITE_CULL_TILE_SIZE - 1) /
+		             SPRITE_CULL_TILE_SIZE;
+	}
+
+	uint64_t batchesSize = (uint64_t)batches.size() * sizeof(SpriteCullBatch);
+	uint64_t tilesSize   = (uint64_t)tileCount * sizeof(SpriteCullTile);
+
+	bool batchesGrown = growCullBuffer(
+	    Allocator, frame.SpriteCullBatchesBuffer, batchesSize,
+	    INITIAL_SPRITE_CULL_BATCHES_SIZE, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	bool tilesGrown =
+	    growCullBuffer(Allocator, frame.SpriteCullTilesBuffer, tilesSize,
+	                   INITIAL_SPRITE_CULL_TILES_SIZE, 0);
+
+	// the new buffers could have the old ones' handles
+	if (batchesGrown || tilesGrown) {
+		frame.SpriteCullDescriptorBuffers = {};
+	}
+
+	// the shader fills in the draws and the tiles' offsets
+	SpriteCullBatch *cullBatches =
+	    (SpriteCullBatch *)frame.SpriteCullBatchesBuffer.Data;
+	SpriteCullTile *tiles = (SpriteCullTile *)frame.SpriteCullTilesBuffer.Data;
+
+	uint32_t tile = 0;
+	for (uint32_t i = 0; i < batches.size(); i++) {
+		cullBatches[i]           = {};
+		cullBatches[i].FirstQuad = batches[i].FirstQuad;
+		cullBatches[i].QuadCount = batches[i].QuadCount;
+		cullBatches[i].FirstTile = tile;
+
+		for (uint32_t first = 0; first < batches[i].QuadCount;
+		     first += SPRITE_CULL_TILE_SIZE) {
+			tiles[tile].Batch     = i;
+			tiles[tile].FirstQuad = batches[i].FirstQuad + first;
+			tiles[tile].QuadCount = std::min(batches[i].QuadCount - first,
+			                                 SPRITE_CULL_TILE_SIZE);
+			tiles[tile].Offset    = 0;
+			tile++;
+		}
+
+		cullBatches[i].TileCount = tile - cullBatches[i].FirstTile;
+	}
+
+	VK_CHECK(vmaFlushAllocation(Allocator,
+	                            frame.SpriteCullBatchesBuffer.Allocation, 0,
+	                            batchesSize));
+	VK_CHECK(vmaFlushAllocation(
+	    Allocator, frame.SpriteCullTilesBuffer.Allocation, 0, tilesSize));
+
+	std::array<VkBuffer, 4> buffers = {
+	    SpritesBuffer, frame.CulledSpritesBuffer,
+	    frame.SpriteCullBatchesBuffer.VulkanBuffer,
+	    frame.SpriteCullTilesBuffer.VulkanBuffer};
+
+	if (frame.SpriteCullDescriptorBuffers != buffers) {
+		VkDescriptorBufferInfo bufferInfos[4];
+		VkWriteDescriptorSet writes[4];
+
+		for (uint32_t i = 0; i < 4; i++) {
+			bufferInfos[i].buffer = buffers[i];
+			bufferInfos[i].offset = 0;
+			bufferInfos[i].range  = VK_WHOLE_SIZE;
+
+			writes[i]                 = {};
+			writes[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].pNext           = nullptr;
+			writes[i].dstBinding      = i;
+			writes[i].dstSet          = frame.SpriteCullDescriptorSet;
+			writes[i].descriptorCount = 1;
+			writes[i].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[i].pBufferInfo     = &bufferInfos[i];
+		}
+
+		vkUpdateDescriptorSets(Device, 4, writes, 0, nullptr);
+
+		frame.SpriteCullDescriptorBuffers = buffers;
+	}
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, SpriteCullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+	                        SpriteCullPipelineLayout, 0, 1,
+	                        &frame.SpriteCullDescriptorSet, 0, nullptr);
+
+	SpriteCullConstants constants;
+	constants.ViewportSize[0] = viewportWidth;
+	constants.ViewportSize[1] = viewportHeight;
+
+	// every pass reads what the one before wrote
+	VkMemoryBarrier passBarrier = {};
+	passBarrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	passBarrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+	passBarrier.dstAccessMask =
+	    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	// one workgroup per tile, so one invocation per sprite
+	constants.Pass  = SPRITE_CULL_PASS_COUNT;
+	constants.Count = tileCount;
+	vkCmdPushConstants(cmd, SpriteCullPipelineLayout,
+	                   VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+	                   &constants);
+	vkCmdDispatch(cmd, tileCount, 1, 1);
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+	                     &passBarrier, 0, nullptr, 0, nullptr);
+
+	// one invocation per batch
+	constants.Pass  = SPRITE_CULL_PASS_SCAN;
+	constants.Count = (uint32_t)batches.size();
+	vkCmdPushConstants(cmd, SpriteCullPipelineLayout,
+	                   VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+	                   &constants);
+	vkCmdDispatch(cmd,
+	              ((uint32_t)batches.size() + SPRITE_CULL_TILE_SIZE - 1) /
+	                  SPRITE_CULL_TILE_SIZE,
+	              1, 1);
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+	                     &passBarrier, 0, nullptr, 0, nullptr);
+
+	constants.Pass  = SPRITE_CULL_PASS_WRITE;
+	constants.Count = tileCount;
+	vkCmdPushConstants(cmd, SpriteCullPipelineLayout,
+	                   VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+	                   &constants);
+	vkCmdDispatch(cmd, tileCount, 1, 1);
+
+	VkMemoryBarrier barrier = {};
+	barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask =
+	    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+	                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+	                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+VkDescriptorSet VkContext::GetSpritesDescriptorSet() {
+	FrameData &frame = GetCurrentFrame();
+
+	// the set isn't used by anything in flight anymore, since the frame's
+	// RenderFence has been waited on
+	if (frame.SpritesDescriptorBuffer != frame.CulledSpritesBuffer) {
+		VkDescriptorBufferInfo descriptorBufferInfo;
+		descriptorBufferInfo.buffer = frame.CulledSpritesBuffer;
+		descriptorBufferInfo.offset = 0;
+		descriptorBufferInfo.range  = frame.CulledSpritesBufferSize;
+
+		VkWriteDescriptorSet setWriteBuffer = {};
+		setWriteBuffer.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		setWriteBuffer.pNext           = nullptr;
+		setWriteBuffer.dstBinding      = 0;
+		setWriteBuffer.dstSet          = frame.SpritesDescriptorSet;
+		setWriteBuffer.descriptorCount = 1;
+		setWriteBuffer.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		setWriteBuffer.pBufferInfo     = &descriptorBufferInfo;
+
+		vkUpdateDescriptorSets(Device, 1, &setWriteBuffer, 0, nullptr);
+
+		frame.SpritesDescriptorBuffer = frame.CulledSpritesBuffer;
+	}
+
+	return frame.SpritesDescriptorSet;
+}
@@ -0,0 +1,441 @@
+#include "vk_context.h"
+#include "../util/util.h"
+#include "../vk_init/vk_init.h"
+#include <algorithm>
+#include <vector>
+
+using namespace azu;
+
+void VkContext::_initTransfer() {
+	// COMMAND POOL
+	// ------------
+
+	VkCommandPoolCreateInfo commandPoolInfo = vk_init::commandPoolCreateInfo(
+	    TransferQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+
+	VK_CHECK(vkCreateCommandPool(Device, &commandPoolInfo, nullptr,
+	                             &_transferContext.commandPool));
+
+	DeletionQueue.pushFunction([](const VkContext &ctx) {
+		vkDestroyCommandPool(ctx.Device, ctx._transferContext.commandPool,
+		                     nullptr);
+	});
+
+	// TIMELINE SEMAPHORE
+	// ------------------
+
+	VkSemaphoreTypeCreateInfo timelineCreateInfo = {};
+	timelineCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineCreateInfo.pNext = nullptr;
+	timelineCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineCreateInfo.initialValue  = 0;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = vk_init::semaphoreCreateInfo();
+	semaphoreCreateInfo.pNext                 = &timelineCreateInfo;
+
+	VK_CHECK(vkCreateSemaphore(Device, &semaphoreCreateInfo, nullptr,
+	                           &_transferContext.timeline));
+
+	VK_CHECK(vkCreateSemaphore(Device, &semaphoreCreateInfo, nullptr,
+	                           &_transferContext.frameTimeline));
+
+	DeletionQueue.pushFunction([](const VkContext &ctx) {
+		vkDestroySemaphore(ctx.Device, ctx._transferContext.timeline, nullptr);
+		vkDestroySemaphore(ctx.Device, ctx._transferContext.frameTimeline,
+		                   nullptr);
+	});
+
+	// STAGING RING
+	// ------------
+
+	_transferContext.stagingRing =
+	    Buffer(Allocator, STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	           VMA_MEMORY_USAGE_CPU_ONLY);
+
+	DeletionQueue.pushFunction([](const VkContext &ctx) {
+		const Buffer &ring = ctx._transferContext.stagingRing;
+		vmaUnmapMemory(ctx.Allocator, ring.Allocation);
+		vmaDestroyBuffer(ctx.Allocator, ring.VulkanBuffer, ring.Allocation);
+
+		// the device is idle at this point, so whatever is left is unused
+		for (auto &[value, buffer] :
+		     ctx._transferContext.oversizedStagingBuffers) {
+			vmaUnmapMemory(ctx.Allocator, buffer.Allocation);
+			vmaDestroyBuffer(ctx.Allocator, buffer.VulkanBuffer,
+			                 buffer.Allocation);
+		}
+	});
+}
+
+VkCommandBuffer VkContext::_getUploadCommandBuffer() {
+	TransferContext &tc = _transferContext;
+
+	if (tc.recording) {
+		return tc.recording;
+	}
+
+	if (tc.freeCommandBuffers.empty()) {
+		VkCommandBufferAllocateInfo cmdAllocInfo =
+		    vk_init::commandBufferAllocateInfo(tc.commandPool, 1);
+
+		VkCommandBuffer cmd;
+		VK_CHECK(vkAllocateCommandBuffers(Device, &cmdAllocInfo, &cmd));
+
+		tc.freeCommandBuffers.push_back(cmd);
+	}
+
+	tc.recording = tc.freeCommandBuffers.back();
+	tc.freeCommandBuffers.pop_back();
+
+	VK_CHECK(vkResetCommandBuffer(tc.recording, 0));
+
+	VkCommandBufferBeginInfo cmdBeginInfo = vk_init::commandBufferBeginInfo(
+	    VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	VK_CHECK(vkBeginCommandBuffer(tc.recording, &cmdBeginInfo));
+
+	return tc.recording;
+}
+
+uint64_t VkContext::_allocateStaging(uint64_t size) {
+	TransferContext &tc = _transferContext;
+
+	const uint64_t ringSize  = tc.stagingRing.Size;
+	const uint64_t alignment = std::max<uint64_t>(
+	    16, GPUProperties.limits.optimalBufferCopyOffsetAlignment);
+
+	uint64_t offset = (tc.stagingHead + alignment - 1) / alignment * alignment;
+
+	// a region can't wrap around the end of the ring, so if it doesn't fit
+	// before the end, it starts at the beginning of the next lap
+	if (offset % ringSize + size > ringSize) {
+		offset = (offset / ringSize + 1) * ringSize;
+	}
+
+	// until the new region fits, wait for the oldest region to be freed
+	while (offset + size - tc.stagingTail > ringSize) {
+		if (tc.stagingRegions.empty()) {
+			tc.stagingTail = offset;
+			break;
+		}
+
+		uint64_t value = tc.stagingRegions.front().value;
+
+		// the oldest region belongs to the batch that's still being
+		// recorded, it has to be submitted before it can be waited on
+		if (value == tc.nextValue) {
+			SubmitUploads();
+		}
+
+		_waitForUpload(value);
+		PollUploads();
+	}
+
+	tc.stagingRegions.push_back({offset + size, tc.nextValue});
+	tc.stagingHead = offset + size;
+
+	return offset % ringSize;
+}
+
+void VkContext::_waitForUpload(uint64_t uploadValue) {
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType               = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.pNext               = nullptr;
+	waitInfo.semaphoreCount      = 1;
+	waitInfo.pSemaphores         = &_transferContext.timeline;
+	waitInfo.pValues             = &uploadValue;
+
+	VK_CHECK(vkWaitSemaphores(Device, &waitInfo, UINT64_MAX));
+}
+
+void VkContext::_stageUpload(const void *pixels, uint64_t size,
+                             VkBuffer &stagingBuffer,
+                             uint64_t &stagingOffset) {
+	TransferContext &tc = _transferContext;
+
+	if (size > tc.stagingRing.Size) {
+		// Buffer sizes are 32 bit
+		if (size > UINT32_MAX) {
+			throw std::runtime_error("Upload too big for a staging buffer");
+		}
+
+		Buffer oversizedBuffer =
+		    Buffer(Allocator, (uint32_t)size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		           VMA_MEMORY_USAGE_CPU_ONLY);
+		memcpy(oversizedBuffer.Data, pixels, size);
+
+		tc.oversizedStagingBuffers.push_back({tc.nextValue, oversizedBuffer});
+
+		stagingBuffer = oversizedBuffer.VulkanBuffer;
+		stagingOffset = 0;
+	} else {
+		// this might submit the current batch to make room, so the command
+		// buffer is only fetched afterwards
+		stagingOffset = _allocateStaging(size);
+		memcpy((uint8_t *)tc.stagingRing.Data + stagingOffset, pixels, size);
+
+		stagingBuffer = tc.stagingRing.VulkanBuffer;
+	}
+}
+
+uint64_t VkContext::UploadImage(VkImage image, VkExtent3D extent,
+                                const void *pixels, uint64_t size,
+                                bool keepForMipmaps) {
+	VkBuffer stagingBuffer;
+	uint64_t stagingOffset;
+	_stageUpload(pixels, size, stagingBuffer, stagingOffset);
+
+	const uint64_t levelOffset = 0;
+
+	VkImageLayout finalLayout = keepForMipmaps
+	                                ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+	                                : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	_recordImageUpload(image, extent, stagingBuffer, stagingOffset,
+	                   {&levelOffset, 1}, finalLayout);
+
+	return _transferContext.nextValue;
+}
+
+uint64_t VkContext::UploadImageLevels(VkImage image, VkExtent3D extent,
+                                      const void *data, uint64_t size,
+                                      std::span<const uint64_t> levelOffsets) {
+	VkBuffer stagingBuffer;
+	uint64_t stagingOffset;
+	_stageUpload(data, size, stagingBuffer, stagingOffset);
+
+	_recordImageUpload(image, extent, stagingBuffer, stagingOffset,
+	                   levelOffsets, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	return _transferContext.nextValue;
+}
+
+void VkContext::_recordImageUpload(VkImage image, VkExtent3D extent,
+                                   VkBuffer stagingBuffer,
+                                   uint64_t stagingOffset,
+                                   std::span<const uint64_t> levelOffsets,
+                                   VkImageLayout finalLayout) {
+	VkCommandBuffer cmd = _getUploadCommandBuffer();
+
+	// TRANSFER IMAGE TO
+	// VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+	// ------------------------------------------------------
+
+	VkImageSubresourceRange range;
+	range.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel   = 0;
+	range.levelCount     = (uint32_t)levelOffsets.size();
+	range.baseArrayLayer = 0;
+	range.layerCount     = 1;
+
+	VkImageMemoryBarrier imageBarrier_toTransfer = {};
+	imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+
+	imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageBarrier_toTransfer.image     = image;
+	imageBarrier_toTransfer.subresourceRange = range;
+
+	imageBarrier_toTransfer.srcAccessMask = 0;
+	imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+	                     nullptr, 1, &imageBarrier_toTransfer);
+
+	// COPY BUFFER TO IMAGE
+	// ------------------------------------------------------
+
+	// one region per mip level, all of them in one copy
+	std::vector<VkBufferImageCopy> copyRegions(levelOffsets.size());
+	for (uint32_t level = 0; level < levelOffsets.size(); level++) {
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.bufferOffset      = stagingOffset + levelOffsets[level];
+		copyRegion.bufferRowLength   = 0;
+		copyRegion.bufferImageHeight = 0;
+
+		copyRegion.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.mipLevel       = level;
+		copyRegion.imageSubresource.baseArrayLayer = 0;
+		copyRegion.imageSubresource.layerCount     = 1;
+		copyRegion.imageExtent = {std::max(extent.width >> level, 1u),
+		                          std::max(extent.height >> level, 1u), 1};
+
+		copyRegions[level] = copyRegion;
+	}
+
+	vkCmdCopyBufferToImage(cmd, stagingBuffer, image,
+	                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                       (uint32_t)copyRegions.size(), copyRegions.data());
+
+	// TRANSFER IMAGE TO
+	// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	// ------------------------------------------------------
+
+	// the transfer queue might not support the fragment shader stage, so the
+	// barrier ends at the bottom of the pipe. Checking the timeline on the
+	// CPU isn't enough to make the writes visible to the graphics queue:
+	// every frame submit waits on the timeline at the last value seen
+	// completed, and that semaphore wait is what orders the sampling after
+	// the upload
+	VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
+
+	imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageBarrier_toReadable.newLayout = finalLayout;
+
+	imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imageBarrier_toReadable.dstAccessMask = 0;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
+	                     nullptr, 1, &imageBarrier_toReadable);
+}
+
+uint64_t VkContext::UploadImageRegion(VkImage image, VkOffset3D offset,
+                                      VkExtent3D extent, const void *pixels,
+                                      uint64_t size, bool firstUpload) {
+	VkBuffer stagingBuffer;
+	uint64_t stagingOffset;
+	_stageUpload(pixels, size, stagingBuffer, stagingOffset);
+
+	VkCommandBuffer cmd = _getUploadCommandBuffer();
+
+	VkImageSubresourceRange range;
+	range.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel   = 0;
+	range.levelCount     = 1;
+	range.baseArrayLayer = 0;
+	range.layerCount     = 1;
+
+	// The image stays in VK_IMAGE_LAYOUT_GENERAL for its whole life, so other
+	// regions of it can keep being sampled while this one is written. The
+	// region might have belonged to an evicted texture that frames in flight
+	// still sample though, so the batch waits for the submitted frames before
+	// writing. The barrier orders this copy after earlier copies into the
+	// image (and its first use discards whatever was in it)
+	_transferContext.waitForFrames = true;
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType                = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout =
+	    firstUpload ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_GENERAL;
+	barrier.newLayout        = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.image            = image;
+	barrier.subresourceRange = range;
+	barrier.srcAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+	                     nullptr, 1, &barrier);
+
+	VkBufferImageCopy copyRegion = {};
+	copyRegion.bufferOffset      = stagingOffset;
+	copyRegion.bufferRowLength   = 0;
+	copyRegion.bufferImageHeight = 0;
+
+	copyRegion.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+	copyRegion.imageSubresource.mipLevel       = 0;
+	copyRegion.imageSubresource.baseArrayLayer = 0;
+	copyRegion.imageSubresource.layerCount     = 1;
+	copyRegion.imageOffset                     = offset;
+	copyRegion.imageExtent                     = extent;
+
+	vkCmdCopyBufferToImage(cmd, stagingBuffer, image, VK_IMAGE_LAYOUT_GENERAL,
+	                       1, &copyRegion);
+
+	return _transferContext.nextValue;
+}
+
+void VkContext::SubmitUploads() {
+	TransferContext &tc = _transferContext;
+
+	if (!tc.recording) {
+		return;
+	}
+
+	VK_CHECK(vkEndCommandBuffer(tc.recording));
+
+	uint64_t signalValue = tc.nextValue;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.pNext = nullptr;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues    = &signalValue;
+
+	VkSubmitInfo submit         = vk_init::submitInfo(&tc.recording);
+	submit.pNext                = &timelineInfo;
+	submit.signalSemaphoreCount = 1;
+	submit.pSignalSemaphores    = &tc.timeline;
+
+	// atlas writes wait until the frames sampling the atlas pages are done,
+	// see UploadImageRegion
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+	if (tc.waitForFrames) {
+		timelineInfo.waitSemaphoreValueCount = 1;
+		timelineInfo.pWaitSemaphoreValues    = &tc.submittedFrameValue;
+
+		submit.waitSemaphoreCount = 1;
+		submit.pWaitSemaphores    = &tc.frameTimeline;
+		submit.pWaitDstStageMask  = &waitStage;
+	}
+
+	VK_CHECK(vkQueueSubmit(TransferQueue, 1, &submit, VK_NULL_HANDLE));
+
+	tc.pendingCommandBuffers.push_back({tc.recording, signalValue});
+	tc.recording     = nullptr;
+	tc.waitForFrames = false;
+	tc.nextValue++;
+}
+
+void VkContext::PollUploads() {
+	TransferContext &tc = _transferContext;
+
+	VK_CHECK(vkGetSemaphoreCounterValue(Device, tc.timeline,
+	                                    &tc.completedValue));
+
+	while (!tc.pendingCommandBuffers.empty() &&
+	       tc.pendingCommandBuffers.front().second <= tc.completedValue) {
+		tc.freeCommandBuffers.push_back(
+		    tc.pendingCommandBuffers.front().first);
+		tc.pendingCommandBuffers.pop_front();
+	}
+
+	while (!tc.stagingRegions.empty() &&
+	       tc.stagingRegions.front().value <= tc.completedValue) {
+		tc.stagingTail = tc.stagingRegions.front().end;
+		tc.stagingRegions.pop_front();
+	}
+
+	while (!tc.oversizedStagingBuffers.empty() &&
+	       tc.oversizedStagingBuffers.front().first <= tc.completedValue) {
+		Buffer &buffer = tc.oversizedStagingBuffers.front().second;
+		vmaUnmapMemory(Allocator, buffer.Allocation);
+		vmaDestroyBuffer(Allocator, buffer.VulkanBuffer, buffer.Allocation);
+		tc.oversizedStagingBuffers.pop_front();
+	}
+}
+
+void VkContext::WaitForUploads() {
+	SubmitUploads();
+	_waitForUpload(_transferContext.nextValue - 1);
+	PollUploads();
+}
+
+void VkContext::FillImageQueueFamilies(VkImageCreateInfo &imageInfo,
+                                       uint32_t (&queueFamilies)[2]) const {
+	if (GraphicsQueueFamily == TransferQueueFamily) {
+		return;
+	}
+
+	// concurrent sharing avoids having to transfer the ownership of every
+	// image from the transfer to the graphics queue family
+	queueFamilies[0] = GraphicsQueueFamily;
+	queueFamilies[1] = TransferQueueFamily;
+
+	imageInfo.sharingMode           = VK_SHARING_MODE_CONCURRENT;
+	imageInfo.queueFamilyIndexCount = 2;
+	imageInfo.pQueueFamilyIndices   = queueFamilies;
+}
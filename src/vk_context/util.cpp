@@ -2,12 +2,180 @@
 #include "../util/util.h"
 #include "../vk_init/vk_init.h"
 #include "VkBootstrap.h"
+#include <algorithm>
 
 using namespace azu;
 
-void VkContext::FillQuadsBuffer(std::span<QuadData> quadData) {
-	memset(QuadsBuffer.Data, 0, INITIAL_QUADS_BUFFER_SIZE);
-	memcpy(QuadsBuffer.Data, quadData.data(), quadData.size_bytes());
+void VkContext::EnsureQuadsBufferCapacity(uint32_t quadCount) {
+	FrameData &frame = GetCurrentFrame();
+
+	uint64_t requiredSize = (uint64_t)quadCount * sizeof(QuadData);
+	if (requiredSize <= frame.QuadsBuffer.Size) {
+		return;
+	}
+
+	uint64_t maxSize = GPUProperties.limits.maxStorageBufferRange;
+	if (requiredSize > maxSize) {
+		throw std::runtime_error("Too many quads for a single quads buffer");
+	}
+
+	// grow geometrically so that a steadily increasing number of quads only
+	// causes a logarithmic number of reallocations
+	uint64_t newSize = frame.QuadsBuffer.Size;
+	while (newSize < requiredSize) {
+		newSize *= 2;
+	}
+	newSize = std::min(newSize, maxSize);
+
+	// the old buffer might still be referenced by commands recorded for this
+	// frame slot, so it's only destroyed the next time the slot is reused
+	Buffer oldBuffer = frame.QuadsBuffer;
+	frame.DeletionQueue.pushFunction([oldBuffer](const VkContext &ctx) {
+		vmaUnmapMemory(ctx.Allocator, oldBuffer.Allocation);
+		vmaDestroyBuffer(ctx.Allocator, oldBuffer.VulkanBuffer,
+		                 oldBuffer.Allocation);
+	});
+
+	frame.QuadsBuffer =
+	    Buffer(Allocator, (uint32_t)newSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	           VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+	// point the frame's descriptor set to the new buffer
+	VkDescriptorBufferInfo descriptorBufferInfo;
+	descriptorBufferInfo.buffer = frame.QuadsBuffer.VulkanBuffer;
+	descriptorBufferInfo.offset = 0;
+	descriptorBufferInfo.range  = frame.QuadsBuffer.Size;
+
+	VkWriteDescriptorSet setWriteBuffer = {};
+	setWriteBuffer.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	setWriteBuffer.pNext           = nullptr;
+	setWriteBuffer.dstBinding      = 0;
+	setWriteBuffer.dstSet          = frame.QuadsDescriptorSet;
+	setWriteBuffer.descriptorCount = 1;
+	setWriteBuffer.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	setWriteBuffer.pBufferInfo     = &descriptorBufferInfo;
+
+	vkUpdateDescriptorSets(Device, 1, &setWriteBuffer, 0, nullptr);
+}
+
+void VkContext::FlushTextureDescriptorWrites() {
+	if (_pendingTextureDescriptorWrites.empty()) {
+		return;
+	}
+
+	std::vector<VkWriteDescriptorSet> writes;
+	writes.reserve(_pendingTextureDescriptorWrites.size());
+
+	for (auto &[slot, imageInfo] : _pendingTextureDescriptorWrites) {
+		VkWriteDescriptorSet setWriteImage = {};
+		setWriteImage.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		setWriteImage.pNext           = nullptr;
+		setWriteImage.dstBinding      = 0;
+		setWriteImage.dstArrayElement = slot;
+		setWriteImage.dstSet          = GlobalDescriptorSet;
+		setWriteImage.descriptorType =
+		    VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		setWriteImage.descriptorCount = 1;
+		setWriteImage.pImageInfo      = &imageInfo;
+
+		writes.push_back(setWriteImage);
+	}
+
+	vkUpdateDescriptorSets(Device, (uint32_t)writes.size(), writes.data(), 0,
+	                       nullptr);
+
+	_pendingTextureDescriptorWrites.clear();
+}
+
+void VkContext::FlushQuadsBuffer() {
+	FrameData &frame = GetCurrentFrame();
+
+	VK_CHECK(vmaFlushAllocation(Allocator, frame.QuadsBuffer.Allocation, 0,
+	                            (VkDeviceSize)frame.QuadCount *
+	                                sizeof(QuadData)));
+}
+
+void VkContext::SortQuads() {
+	FrameData &frame = GetCurrentFrame();
+
+	// the sequence is already in order, so only the bits above it are sorted
+	RadixSort(frame.QuadKeys, _quadKeysScratch, QUAD_KEY_SEQUENCE_BITS);
+
+	frame.QuadCount = (uint32_t)frame.QuadKeys.size();
+	EnsureQuadsBufferCapacity(frame.QuadCount);
+
+	// the buffer is written front to back, a whole struct at a time, since
+	// anything else is a lot slower on write-combined memory
+	const uint64_t sequenceMask = (1ull << QUAD_KEY_SEQUENCE_BITS) - 1;
+	QuadData *quads             = (QuadData *)frame.QuadsBuffer.Data;
+	for (uint32_t i = 0; i < frame.QuadCount; i++) {
+		memcpy(quads + i, &frame.Quads[frame.QuadKeys[i] & sequenceMask],
+		       sizeof(QuadData));
+	}
+}
+
+void VkContext::BatchQuads(std::span<const uint64_t> keys,
+                           std::vector<QuadBatch> &batches) const {
+	batches.clear();
+
+	auto flagsOf = [&](uint32_t i) {
+		return (uint32_t)(keys[i] >> QUAD_KEY_PIPELINE_SHIFT) & 0x7;
+	};
+	auto textureOf = [&](uint32_t i) {
+		return (uint32_t)(keys[i] >> QUAD_KEY_TEXTURE_SHIFT) & 0xFFFF;
+	};
+	// batches don't span layers, so sprites can be drawn between them
+	auto layerOf = [&](uint32_t i) {
+		return (uint32_t)(keys[i] >> QUAD_KEY_LAYER_SHIFT);
+	};
+
+	const uint32_t count = (uint32_t)keys.size();
+
+	uint32_t runStart = 0;
+	while (runStart < count) {
+		// find the run of quads that need the same variant and texture
+		uint32_t flags   = flagsOf(runStart);
+		uint32_t texture = textureOf(runStart);
+		uint32_t layer   = layerOf(runStart);
+		uint32_t runEnd  = runStart + 1;
+		while (runEnd < count && flagsOf(runEnd) == flags &&
+		       textureOf(runEnd) == texture && layerOf(runEnd) == layer) {
+			runEnd++;
+		}
+
+		uint32_t runLength = runEnd - runStart;
+		bool textured      = flags & QUAD_PIPELINE_TEXTURED;
+
+		// any variant whose flags include the run's can draw it too, so a
+		// short run is folded into the previous batch to save a pipeline
+		// switch, unless both sample from different textures. The order of
+		// the quads never changes
+		bool merge = false;
+		if (!batches.empty()) {
+			const QuadBatch &last = batches.back();
+			bool lastTextured     = last.PipelineFlags & QUAD_PIPELINE_TEXTURED;
+
+			bool sameTexture =
+			    !(textured && lastTextured && last.TextureIndex != texture);
+
+			merge = (runLength < MIN_QUAD_BATCH_SIZE ||
+			         last.PipelineFlags == flags) &&
+			        sameTexture && last.Layer == layer;
+		}
+
+		if (merge) {
+			QuadBatch &last = batches.back();
+			last.QuadCount += runLength;
+			last.PipelineFlags |= flags;
+			if (textured) {
+				last.TextureIndex = texture;
+			}
+		} else {
+			batches.push_back({runStart, runLength, flags, texture, layer});
+		}
+
+		runStart = runEnd;
+	}
 }
 
 void VkContext::ImmediateSubmit(
@@ -42,8 +210,10 @@ void VkContext::ImmediateSubmit(
 	vkResetCommandPool(Device, _immediateSubmitContext.commandPool, 0);
 }
 
-void VkContext::HandleWindowResize(VkExtent2D newWindowExtent) {
-	WindowExtent = newWindowExtent;
+void VkContext::RecreateSwapchain() {
+	if (Headless) {
+		throw std::runtime_error("A headless context has no swapchain");
+	}
 
 	// DESTROY CURRENT FRAMEBUFFERS AND SWAPCHAIN
 	// ==========================================
@@ -53,39 +223,222 @@ void VkContext::HandleWindowResize(VkExtent2D newWindowExtent) {
 		vkDestroyImageView(Device, SwapchainImageViews[i], nullptr);
 	}
 
+	if (UseDepthBuffer) {
+		_destroyDepthImage();
+	}
+
 	vkDestroySwapchainKHR(Device, Swapchain, nullptr);
 
-	// CREATE NEW SWAPCHAIN
-	// ====================
+	// CREATE NEW SWAPCHAIN AND FRAMEBUFFERS
+	// =====================================
+
+	_createSwapchain();
+	_createFramebuffers();
+}
+
+void VkContext::HandleWindowResize(VkExtent2D newWindowExtent) {
+	WindowExtent = newWindowExtent;
+
+	RecreateSwapchain();
+}
+
+std::vector<uint8_t> VkContext::ReadOffscreenImage() {
+	if (!Headless) {
+		throw std::runtime_error("Only a headless context has an offscreen "
+		                         "image");
+	}
+
+	vkDeviceWaitIdle(Device);
 
-	vkb::SwapchainBuilder vkbSwapchainBuilder{chosenGPU, Device, Surface};
+	uint32_t size = WindowExtent.width * WindowExtent.height * 4;
 
-	vkb::Swapchain vkbSwapchain =
-	    vkbSwapchainBuilder
-	        .use_default_format_selection()
-	        // use vsync present mode
-	        .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-	        .set_desired_extent(WindowExtent.width, WindowExtent.height)
-	        .build()
-	        .value();
+	Buffer readbackBuffer =
+	    Buffer(Allocator, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	           VMA_MEMORY_USAGE_GPU_TO_CPU);
 
-	Swapchain            = vkbSwapchain.swapchain;
-	SwapchainImages      = vkbSwapchain.get_images().value();
-	SwapchainImageViews  = vkbSwapchain.get_image_views().value();
-	SwapchainImageFormat = vkbSwapchain.image_format;
+	ImmediateSubmit([&](VkCommandBuffer cmd) {
+		// make the render pass' writes visible to the copy. The image is
+		// already in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL thanks to the
+		// render pass' finalLayout
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType         = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.image         = SwapchainImages[0];
+		barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel   = 0;
+		barrier.subresourceRange.levelCount     = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount     = 1;
 
-	// CREATE NEW FRAMEBUFFERS
-	// =======================
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		                     VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+		                     nullptr, 1, &barrier);
 
-	VkFramebufferCreateInfo framebufferInfo =
-	    vk_init::framebufferCreateInfo(RenderPass, WindowExtent);
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.bufferOffset      = 0;
+		copyRegion.bufferRowLength   = 0;
+		copyRegion.bufferImageHeight = 0;
 
-	const uint32_t swapchainImageCount = (uint32_t)SwapchainImages.size();
-	Framebuffers = std::vector<VkFramebuffer>(swapchainImageCount);
+		copyRegion.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.mipLevel       = 0;
+		copyRegion.imageSubresource.baseArrayLayer = 0;
+		copyRegion.imageSubresource.layerCount     = 1;
+		copyRegion.imageExtent = {WindowExtent.width, WindowExtent.height, 1};
+
+		vkCmdCopyImageToBuffer(cmd, SwapchainImages[0],
+		                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		                       readbackBuffer.VulkanBuffer, 1, &copyRegion);
+	});
+
+	VK_CHECK(vmaInvalidateAllocation(Allocator, readbackBuffer.Allocation, 0,
+	                                 size));
+
+	std::vector<uint8_t> pixels(size);
+	memcpy(pixels.data(), readbackBuffer.Data, size);
+
+	vmaUnmapMemory(Allocator, readbackBuffer.Allocation);
+	vmaDestroyBuffer(Allocator, readbackBuffer.VulkanBuffer,
+	                 readbackBuffer.Allocation);
+
+	return pixels;
+}
 
-	for (uint32_t i = 0; i < swapchainImageCount; i++) {
-		framebufferInfo.pAttachments = &SwapchainImageViews[i];
-		VK_CHECK(vkCreateFramebuffer(Device, &framebufferInfo, nullptr,
-		                             &Framebuffers[i]));
+void VkContext::SetPresentMode(VkPresentModeKHR presentMode,
+                               uint32_t minSwapchainImageCount) {
+	DesiredPresentMode            = presentMode;
+	DesiredMinSwapchainImageCount = minSwapchainImageCount;
+
+	RecreateSwapchain();
+}
+
+bool VkContext::SupportsTextureFormat(VkFormat format) const {
+	bool blockCompressed = format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK &&
+	                       format <= VK_FORMAT_BC7_SRGB_BLOCK;
+	if (blockCompressed && !EnabledFeatures.textureCompressionBC) {
+		return false;
 	}
-}
\ No newline at end of file
+
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(chosenGPU, format, &properties);
+
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+	                                VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+
+	return (properties.optimalTilingFeatures & required) == required;
+}
+
+bool VkContext::SupportsMipmapGeneration(VkFormat format) const {
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(chosenGPU, format, &properties);
+
+	VkFormatFeatureFlags required =
+	    VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+	    VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+	return (properties.optimalTilingFeatures & required) == required;
+}
+
+void VkContext::GenerateMipmaps(VkCommandBuffer cmd, VkImage image,
+                                VkExtent3D extent, uint32_t mipLevels) {
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType                = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image                = image;
+	barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount     = 1;
+
+	// level 0 was written (and left in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+	// by the transfer queue, the rest of the levels have never been touched
+	barrier.oldLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	barrier.subresourceRange.baseMipLevel = 1;
+	barrier.subresourceRange.levelCount   = mipLevels - 1;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+	                     VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+	                     nullptr, 1, &barrier);
+
+	int32_t width  = (int32_t)extent.width;
+	int32_t height = (int32_t)extent.height;
+
+	barrier.subresourceRange.levelCount = 1;
+
+	for (uint32_t level = 1; level < mipLevels; level++) {
+		int32_t nextWidth  = std::max(width / 2, 1);
+		int32_t nextHeight = std::max(height / 2, 1);
+
+		VkImageBlit blit = {};
+		blit.srcOffsets[1]                 = {width, height, 1};
+		blit.srcSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel       = level - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount     = 1;
+		blit.dstOffsets[1]                 = {nextWidth, nextHeight, 1};
+		blit.dstSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel       = level;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount     = 1;
+
+		vkCmdBlitImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+		               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+		               VK_FILTER_LINEAR);
+
+		// the level that was just written is the source of the next blit
+		barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		barrier.subresourceRange.baseMipLevel = level;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		                     VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+		                     nullptr, 1, &barrier);
+
+		width  = nextWidth;
+		height = nextHeight;
+	}
+
+	barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barrier.newLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount   = mipLevels;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+	                     0, nullptr, 1, &barrier);
+}
+
+uint64_t VkContext::GetDeviceMemoryOverBudget() const {
+	const VkPhysicalDeviceMemoryProperties *memoryProperties;
+	vmaGetMemoryProperties(Allocator, &memoryProperties);
+
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(Allocator, budgets);
+
+	// some headroom is left, allocations start failing (or spilling into
+	// system memory) before the budget is reached
+	uint64_t over = 0;
+	for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++) {
+		if (!(memoryProperties->memoryHeaps[i].flags &
+		      VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) {
+			continue;
+		}
+
+		uint64_t limit = budgets[i].budget / 10 * 9;
+		if (budgets[i].usage > limit) {
+			over += budgets[i].usage - limit;
+		}
+	}
+
+	return over;
+}
@@ -3,30 +3,169 @@
 
 #include "../util/quad_data.h"
 #include "../util/buffer.h"
+#include "../util/quad_culling.h"
+#include "../util/radix_sort.h"
 #include "vk_mem_alloc.h"
 #include <SDL.h>
 #include <vulkan/vulkan.h>
+#include <array>
 #include <optional>
-#include <span>
+#include <cstring>
 #include <vector>
 #include <deque>
+#include <span>
+#include <stdexcept>
 #include <functional>
+#include <string>
 
 namespace azu {
 
+class VkContext;
+
+struct DeletionQueue {
+	std::deque<std::function<void(const VkContext &context)>> deletors;
+
+	void pushFunction(std::function<void(const VkContext &)> &&function) {
+		deletors.push_back(function);
+	}
+
+	void flush(const VkContext &context) {
+		for (auto it = deletors.rbegin(); it != deletors.rend(); it++) {
+			(*it)(context);
+		}
+
+		deletors.clear();
+	}
+};
+
+// A run of consecutive quads in the quads buffer that's drawn with a single
+// variant of the quad pipeline
+struct QuadBatch {
+	uint32_t FirstQuad;
+	uint32_t QuadCount;
+	uint32_t PipelineFlags; // QuadPipelineFlags
+	// with QUAD_PIPELINE_TEXTURED, the one texture every quad in the batch
+	// samples from, so the texture index is uniform within the draw
+	uint32_t TextureIndex;
+	// the layer bits of the quads' keys, a batch never spans layers
+	uint32_t Layer;
+};
+
+// Pushed after the projection matrix for every draw of the quad pipelines.
+// Instance i of a draw is quads[FirstQuad + Step * i], so a batch can be
+// drawn in order (Step = 1) or in reverse (Step = -1). DepthOffset is added
+// to the quad's index for its depth (wrapping around), so sprites and quads
+// of every layer get depths in layer order
+struct QuadDrawOrder {
+	int32_t FirstQuad;
+	int32_t Step;
+	uint32_t DepthOffset;
+};
+
+// What the sprite culling compute shader reads and writes for each sprite
+// batch, laid out the same as SpriteBatch in cull_sprites.comp. Draw is read
+// by vkCmdDrawIndirect
+struct SpriteCullBatch {
+	VkDrawIndirectCommand Draw; // written by the shader
+	uint32_t FirstQuad;
+	uint32_t QuadCount;
+	uint32_t FirstTile; // the batch's tiles in the tiles buffer
+	uint32_t TileCount;
+};
+
+// The sprites of a batch are culled SPRITE_CULL_TILE_SIZE at a time, one
+// workgroup per tile, laid out the same as SpriteTile in cull_sprites.comp
+const uint32_t SPRITE_CULL_TILE_SIZE = 256; // cull_sprites.comp's local size
+
+struct SpriteCullTile {
+	uint32_t Batch;
+	uint32_t FirstQuad;
+	uint32_t QuadCount;
+	uint32_t Offset; // written by the shader
+};
+
+// The push constants of cull_sprites.comp, which runs once for every pass
+struct SpriteCullConstants {
+	float ViewportSize[2];
+	uint32_t Pass;
+	uint32_t Count; // tiles, or batches for SPRITE_CULL_PASS_SCAN
+};
+
+const uint32_t SPRITE_CULL_PASS_COUNT = 0;
+const uint32_t SPRITE_CULL_PASS_SCAN  = 1;
+const uint32_t SPRITE_CULL_PASS_WRITE = 2;
+
+// Everything that's needed to record and submit one frame. There are
+// FramesInFlight of these so the CPU can record frame N+1 while the GPU is
+// still busy with frame N
+struct FrameData {
+	VkSemaphore PresentSemaphore = nullptr;
+	VkSemaphore RenderSemaphore  = nullptr;
+	VkFence RenderFence          = nullptr;
+
+	VkCommandPool CommandPool         = nullptr;
+	VkCommandBuffer MainCommandBuffer = nullptr;
+
+	// the quads pushed this frame in the order they were pushed, and their
+	// sort keys, which SortQuads puts in draw order
+	std::vector<QuadData> Quads;
+	std::vector<uint64_t> QuadKeys;
+
+	Buffer QuadsBuffer;
+	VkDescriptorSet QuadsDescriptorSet = nullptr;
+	uint32_t QuadCount = 0; // quads written into QuadsBuffer this frame
+
+	std::vector<QuadBatch> QuadBatches; // filled by BatchQuads
+
+	// sprites that changed are copied from here into the sprites buffer
+	Buffer SpritesStagingBuffer = Buffer();
+
+	// the sprites that are inside the window, written by CullSprites at the
+	// front of their batch's range
+	VkBuffer CulledSpritesBuffer                = nullptr;
+	VmaAllocation CulledSpritesBufferAllocation = nullptr;
+	uint64_t CulledSpritesBufferSize            = 0; // Unit: bytes
+
+	// a SpriteCullBatch for every sprite batch, and the SpriteCullTiles they
+	// are split into
+	Buffer SpriteCullBatchesBuffer = Buffer();
+	Buffer SpriteCullTilesBuffer   = Buffer();
+
+	// set 0 for drawing sprites, and the culled sprites buffer it points to
+	// (which might have been replaced since this frame last drew)
+	VkDescriptorSet SpritesDescriptorSet = nullptr;
+	VkBuffer SpritesDescriptorBuffer     = nullptr;
+
+	// the set for culling sprites, and the sprites, culled sprites, batches
+	// and tiles buffers it points to
+	VkDescriptorSet SpriteCullDescriptorSet             = nullptr;
+	std::array<VkBuffer, 4> SpriteCullDescriptorBuffers = {};
+
+	// resources that were in use by this frame and can only be destroyed once
+	// its RenderFence has been waited on again (e.g. a quads buffer that got
+	// replaced by a bigger one)
+	azu::DeletionQueue DeletionQueue;
+};
+
 class VkContext {
 	void _initVulkan(SDL_Window *window, bool useValidationLayers);
 	void _initSwapchain();
+	void _initOffscreenImage();
 	void _initDefaultRenderpass();
 	void _initFramebuffers();
+	void _createSwapchain();
+	void _createFramebuffers();
+	void _createDepthImage();
+	void _destroyDepthImage() const;
 	void _initCommands();
 	void _initSyncStructures();
+	void _initTransfer();
 	void _initDescriptors();
 	void _initSampler();
+	void _initPipelineCache(const char *directory);
 	void _initPipelines();
 
-	std::optional<VkShaderModule>
-	_loadShaderModuleFromFile(const char *path) const;
+	VkShaderModule _createShaderModule(std::span<const uint32_t> code) const;
 
 	struct ImmediateSubmitContext {
 		VkFence fence;
@@ -36,44 +175,174 @@ class VkContext {
 
 	ImmediateSubmitContext _immediateSubmitContext;
 
+	// Texture uploads are recorded into a batch that gets submitted to the
+	// transfer queue without waiting for it. Every batch signals the next
+	// value of the timeline semaphore when it's done, and that value is what
+	// callers use to check whether their upload has landed
+	struct TransferContext {
+		VkCommandPool commandPool;
+		VkSemaphore timeline;
+
+		uint64_t nextValue      = 1; // signaled by the batch being recorded
+		uint64_t completedValue = 0; // last value known to be reached
+
+		// signaled by every frame submit, see SubmitFrameValue. Batches
+		// that write into atlas pages wait on it, since frames in flight
+		// might still be sampling the regions being overwritten
+		VkSemaphore frameTimeline;
+		uint64_t submittedFrameValue = 0;
+		bool waitForFrames           = false; // for the batch being recorded
+
+		VkCommandBuffer recording = nullptr; // batch being recorded, if any
+		std::vector<VkCommandBuffer> freeCommandBuffers;
+		std::deque<std::pair<VkCommandBuffer, uint64_t>> pendingCommandBuffers;
+
+		// Pixels are staged in a persistently mapped ring buffer. Offsets
+		// only ever grow, the physical offset is the offset modulo the size.
+		// Every region remembers the batch that reads from it, so it can be
+		// reused once that batch is done
+		struct StagingRegion {
+			uint64_t end;
+			uint64_t value;
+		};
+
+		Buffer stagingRing;
+		uint64_t stagingHead = 0;
+		uint64_t stagingTail = 0;
+		std::deque<StagingRegion> stagingRegions;
+
+		// uploads too big for the ring get their own staging buffer, which
+		// is destroyed once the batch that reads from it is done
+		std::deque<std::pair<uint64_t, Buffer>> oversizedStagingBuffers;
+	};
+
+	TransferContext _transferContext;
+
+	// texture descriptor writes that haven't been flushed yet, see
+	// QueueTextureDescriptorWrite
+	std::vector<std::pair<uint32_t, VkDescriptorImageInfo>>
+	    _pendingTextureDescriptorWrites;
+
+	std::vector<uint64_t> _quadKeysScratch; // for sorting QuadKeys
+
+	// what's in the pipeline cache file, to only write it when it changed
+	std::vector<uint8_t> _loadedPipelineCacheData;
+
+	VkCommandBuffer _getUploadCommandBuffer();
+	uint64_t _allocateStaging(uint64_t size);
+	void _stageUpload(const void *pixels, uint64_t size,
+	                  VkBuffer &stagingBuffer, uint64_t &stagingOffset);
+	// Copies each level of image from stagingBuffer at stagingOffset plus the
+	// level's offset, leaving the image in finalLayout
+	void _recordImageUpload(VkImage image, VkExtent3D extent,
+	                        VkBuffer stagingBuffer, uint64_t stagingOffset,
+	                        std::span<const uint64_t> levelOffsets,
+	                        VkImageLayout finalLayout);
+	void _waitForUpload(uint64_t uploadValue);
+
   public:
 	VkInstance Instance                     = nullptr;
 	VkDebugUtilsMessengerEXT DebugMessenger = nullptr;
 	VkPhysicalDevice chosenGPU              = nullptr;
+	VkPhysicalDeviceProperties GPUProperties;
+	VkPhysicalDeviceFeatures EnabledFeatures;
 	VkDevice Device                         = nullptr;
 
-	VkSemaphore PresentSemaphore, RenderSemaphore = nullptr;
-	VkFence RenderFence = nullptr;
-
 	VkQueue GraphicsQueue = nullptr;
 	uint32_t GraphicsQueueFamily;
 
-	VkCommandPool CommandPool         = nullptr;
-	VkCommandBuffer MainCommandBuffer = nullptr;
+	VkQueue TransferQueue = nullptr; // can be the same as GraphicsQueue
+	uint32_t TransferQueueFamily;
+
+	std::vector<FrameData> Frames;
+	uint32_t CurrentFrameIndex = 0;
 
 	VkRenderPass RenderPass = nullptr;
 
+	// no window, surface or swapchain. Rendering goes into an offscreen image
+	// that takes the place of the (only) swapchain image
+	bool Headless = false;
+
+	const VkFormat OFFSCREEN_IMAGE_FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
+	VmaAllocation OffscreenImageAllocation = nullptr;
+
 	VkSurfaceKHR Surface     = nullptr;
 	VkSwapchainKHR Swapchain = nullptr;
 	VkFormat SwapchainImageFormat;
 
+	// what was asked for, and what the surface actually ended up supporting
+	VkPresentModeKHR DesiredPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	VkPresentModeKHR PresentMode        = VK_PRESENT_MODE_FIFO_KHR;
+	uint32_t DesiredMinSwapchainImageCount = 0; // 0 = vk-bootstrap default
+
+	// Quads are given depths in the order they're drawn, so the GPU can skip
+	// whatever ends up behind an opaque quad (see quad.vert). It's cleared to
+	// 0 and later quads have greater depths
+	bool UseDepthBuffer = false;
+
+	const VkFormat DEPTH_FORMAT        = VK_FORMAT_D32_SFLOAT;
+	VkImage DepthImage                 = nullptr;
+	VmaAllocation DepthImageAllocation = nullptr;
+	VkImageView DepthImageView         = nullptr;
+
 	std::vector<VkFramebuffer> Framebuffers;
 	std::vector<VkImage> SwapchainImages;
 	std::vector<VkImageView> SwapchainImageViews;
 
+	// Every pipeline is compiled through this cache, which is loaded from
+	// PipelineCachePath (if the driver that wrote it can read it) and saved
+	// back there once the pipelines have been built, so later launches skip
+	// compiling them
+	VkPipelineCache PipelineCache = nullptr;
+	std::string PipelineCachePath; // empty if the cache isn't kept on disk
+
+	const char *PIPELINE_CACHE_FILE_NAME = "azu_pipeline_cache.bin";
+
 	VkPipelineLayout PipelineLayout;
-	VkPipeline Pipeline;
+
+	// indexed by QuadPipelineFlags, they all share PipelineLayout. Rounded
+	// variants without QUAD_PIPELINE_BLENDED are never used and aren't built
+	std::array<VkPipeline, QUAD_PIPELINE_COUNT> QuadPipelines;
+
+	// The sprites are culled against the window by a compute shader every
+	// frame, so the CPU never goes through them (see CullSprites)
+	VkPipelineLayout SpriteCullPipelineLayout;
+	VkPipeline SpriteCullPipeline;
+	VkDescriptorSetLayout SpriteCullDescriptorSetLayout;
 
 	VkDescriptorPool GlobalDescriptorPool;
-	VkDescriptorSetLayout GlobalDescriptorSetLayout;
+	VkDescriptorSetLayout FrameDescriptorSetLayout;  // set 0, per frame
+	VkDescriptorSetLayout GlobalDescriptorSetLayout; // set 1, shared
 	VkDescriptorSet GlobalDescriptorSet;
 
 	const uint32_t INITIAL_QUADS_BUFFER_SIZE =
-	    sizeof(QuadData) * 10000; // Unit: bytes
-	Buffer QuadsBuffer;
+	    sizeof(QuadData) * 10000; // Unit: bytes, grows when needed
 
 	const uint32_t INITIAL_ARRAY_OF_TEXTURES_LENGTH = 1000; // Unit: elements
 
+	const uint32_t INITIAL_SPRITES_BUFFER_SIZE =
+	    sizeof(QuadData) * 1024; // Unit: bytes, grows when needed
+
+	const uint32_t INITIAL_SPRITE_CULL_BATCHES_SIZE =
+	    sizeof(SpriteCullBatch) * 64; // Unit: bytes, grows when needed
+
+	const uint32_t INITIAL_SPRITE_CULL_TILES_SIZE =
+	    sizeof(SpriteCullTile) * 64; // Unit: bytes, grows when needed
+
+	// Retained sprites (see Context::CreateSprite) live in a device local
+	// buffer shared by every frame, which only gets written where they
+	// changed. Created by EnsureSpritesBufferCapacity
+	VkBuffer SpritesBuffer                = nullptr;
+	VmaAllocation SpritesBufferAllocation = nullptr;
+	uint64_t SpritesBufferSize            = 0; // Unit: bytes
+
+	// quads in runs shorter than this are drawn with the variant of the run
+	// before them (widened to cover them), since switching pipelines for a
+	// handful of quads costs more than what the cheaper variant saves
+	const uint32_t MIN_QUAD_BATCH_SIZE = 32; // Unit: quads
+
+	const uint32_t STAGING_RING_SIZE = 32 * 1024 * 1024; // Unit: bytes
+
 	VkSampler GlobalSampler;
 
 	VkExtent2D WindowExtent;
@@ -82,8 +351,12 @@ class VkContext {
 
 	VkContext() = default;
 
+	// Passing a null window creates a headless context, and a null
+	// pipelineCacheDirectory doesn't keep the pipeline cache on disk
 	VkContext(SDL_Window *window, VkExtent2D windowExtent,
-	          bool useValidationLayers);
+	          bool useValidationLayers, uint32_t framesInFlight,
+	          VkPresentModeKHR presentMode, uint32_t minSwapchainImageCount,
+	          bool useDepthBuffer, const char *pipelineCacheDirectory);
 
 	VkContext(const VkContext &other)            = delete;
 	VkContext &operator=(const VkContext &other) = delete;
@@ -98,61 +371,293 @@ class VkContext {
 		std::swap(Instance, other.Instance);
 		std::swap(DebugMessenger, other.DebugMessenger);
 		std::swap(chosenGPU, other.chosenGPU);
+		std::swap(GPUProperties, other.GPUProperties);
+		std::swap(EnabledFeatures, other.EnabledFeatures);
 		std::swap(Device, other.Device);
-		std::swap(PresentSemaphore, other.PresentSemaphore);
-		std::swap(RenderSemaphore, other.RenderSemaphore);
-		std::swap(RenderFence, other.RenderFence);
 		std::swap(GraphicsQueue, other.GraphicsQueue);
 		std::swap(GraphicsQueueFamily, other.GraphicsQueueFamily);
-		std::swap(CommandPool, other.CommandPool);
-		std::swap(MainCommandBuffer, other.MainCommandBuffer);
+		std::swap(TransferQueue, other.TransferQueue);
+		std::swap(TransferQueueFamily, other.TransferQueueFamily);
+		std::swap(Frames, other.Frames);
+		std::swap(CurrentFrameIndex, other.CurrentFrameIndex);
 		std::swap(RenderPass, other.RenderPass);
+		std::swap(Headless, other.Headless);
+		std::swap(OffscreenImageAllocation, other.OffscreenImageAllocation);
 		std::swap(Surface, other.Surface);
 		std::swap(Swapchain, other.Swapchain);
 		std::swap(SwapchainImageFormat, other.SwapchainImageFormat);
+		std::swap(DesiredPresentMode, other.DesiredPresentMode);
+		std::swap(PresentMode, other.PresentMode);
+		std::swap(DesiredMinSwapchainImageCount,
+		          other.DesiredMinSwapchainImageCount);
+		std::swap(UseDepthBuffer, other.UseDepthBuffer);
+		std::swap(DepthImage, other.DepthImage);
+		std::swap(DepthImageAllocation, other.DepthImageAllocation);
+		std::swap(DepthImageView, other.DepthImageView);
 		std::swap(Framebuffers, other.Framebuffers);
 		std::swap(SwapchainImages, other.SwapchainImages);
 		std::swap(SwapchainImageViews, other.SwapchainImageViews);
+		std::swap(PipelineCache, other.PipelineCache);
+		std::swap(PipelineCachePath, other.PipelineCachePath);
+		std::swap(_loadedPipelineCacheData, other._loadedPipelineCacheData);
 		std::swap(PipelineLayout, other.PipelineLayout);
-		std::swap(Pipeline, other.Pipeline);
+		std::swap(QuadPipelines, other.QuadPipelines);
+		std::swap(SpriteCullPipelineLayout, other.SpriteCullPipelineLayout);
+		std::swap(SpriteCullPipeline, other.SpriteCullPipeline);
+		std::swap(SpriteCullDescriptorSetLayout,
+		          other.SpriteCullDescriptorSetLayout);
 		std::swap(WindowExtent, other.WindowExtent);
 		std::swap(DeletionQueue, other.DeletionQueue);
 		std::swap(Allocator, other.Allocator);
 		std::swap(GlobalDescriptorPool, other.GlobalDescriptorPool);
+		std::swap(FrameDescriptorSetLayout, other.FrameDescriptorSetLayout);
 		std::swap(GlobalDescriptorSetLayout, other.GlobalDescriptorSetLayout);
 		std::swap(GlobalDescriptorSet, other.GlobalDescriptorSet);
-		std::swap(QuadsBuffer, other.QuadsBuffer);
 		std::swap(_immediateSubmitContext, other._immediateSubmitContext);
+		std::swap(_transferContext, other._transferContext);
+		std::swap(_pendingTextureDescriptorWrites,
+		          other._pendingTextureDescriptorWrites);
+		std::swap(_quadKeysScratch, other._quadKeysScratch);
 		std::swap(GlobalSampler, other.GlobalSampler);
+		std::swap(SpritesBuffer, other.SpritesBuffer);
+		std::swap(SpritesBufferAllocation, other.SpritesBufferAllocation);
+		std::swap(SpritesBufferSize, other.SpritesBufferSize);
 
 		return *this;
 	}
 
 	~VkContext();
 
-	struct DeletionQueue {
-		std::deque<std::function<void(const VkContext &context)>> deletors;
+	azu::DeletionQueue DeletionQueue;
+
+	void ImmediateSubmit(std::function<void(VkCommandBuffer cmd)> &&function);
+
+	// Records a copy of size bytes of pixels into mip level 0 of image, which
+	// ends up in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. Returns right away
+	// with the upload value to pass to IsUploadComplete, the copy only starts
+	// once SubmitUploads is called. Images used with this have to be
+	// shareable between GraphicsQueueFamily and TransferQueueFamily (see
+	// FillImageQueueFamilies). With keepForMipmaps, level 0 is left in
+	// VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL for GenerateMipmaps instead
+	uint64_t UploadImage(VkImage image, VkExtent3D extent, const void *pixels,
+	                     uint64_t size, bool keepForMipmaps = false);
+
+	// Same as UploadImage, but uploads a whole mip chain (e.g. of a block
+	// compressed image) in one go. levelOffsets are where each level starts
+	// in data, starting with level 0
+	uint64_t UploadImageLevels(VkImage image, VkExtent3D extent,
+	                           const void *data, uint64_t size,
+	                           std::span<const uint64_t> levelOffsets);
+
+	// Same as UploadImage, but copies into a region of an image that lives in
+	// VK_IMAGE_LAYOUT_GENERAL (e.g. an atlas page). firstUpload has to be set
+	// for the first upload into the image, which also discards the rest of it
+	uint64_t UploadImageRegion(VkImage image, VkOffset3D offset,
+	                           VkExtent3D extent, const void *pixels,
+	                           uint64_t size, bool firstUpload);
+
+	// Submits everything recorded with UploadImage so far to the transfer
+	// queue, without waiting for it
+	void SubmitUploads();
+
+	// Polls the GPU for finished uploads and recycles their resources
+	void PollUploads();
+
+	// Uses the result of the last PollUploads, so it's cheap enough to be
+	// called for every quad
+	bool IsUploadComplete(uint64_t uploadValue) const {
+		return uploadValue <= _transferContext.completedValue;
+	}
+
+	// Submits and blocks until every upload so far has finished
+	void WaitForUploads();
+
+	// The timeline semaphore signaled by the upload batches. The frame
+	// submit waits on it at GetCompletedUploadValue, which makes the uploads
+	// the frame samples from visible to the graphics queue
+	VkSemaphore GetUploadTimeline() const {
+		return _transferContext.timeline;
+	}
+
+	// The last value PollUploads (or WaitForUploads) saw the timeline reach.
+	// Everything that's drawn was checked with IsUploadComplete against it,
+	// so waiting on it never blocks the frame behind uploads still in flight
+	uint64_t GetCompletedUploadValue() const {
+		return _transferContext.completedValue;
+	}
 
-		void pushFunction(std::function<void(const VkContext &)> &&function) {
-			deletors.push_back(function);
+	// The timeline semaphore every frame submit signals, with the value
+	// returned by SubmitFrameValue
+	VkSemaphore GetFrameTimeline() const {
+		return _transferContext.frameTimeline;
+	}
+
+	// The value the frame about to be submitted signals on GetFrameTimeline.
+	// Atlas uploads submitted afterwards wait for it
+	uint64_t SubmitFrameValue() {
+		return ++_transferContext.submittedFrameValue;
+	}
+
+	// Queues a write of a single slot of the texture array in
+	// GlobalDescriptorSet. The writes are batched into one
+	// vkUpdateDescriptorSets call by FlushTextureDescriptorWrites, so
+	// registering N textures costs O(N) no matter how many there already are
+	void QueueTextureDescriptorWrite(uint32_t slot,
+	                                 VkDescriptorImageInfo imageInfo) {
+		_pendingTextureDescriptorWrites.push_back({slot, imageInfo});
+	}
+
+	// Has to be called before submitting anything that might use the queued
+	// slots
+	void FlushTextureDescriptorWrites();
+
+	// How many bytes of device local memory would have to be freed to get
+	// back under 90% of the budget VMA reports (which comes from
+	// VK_EXT_memory_budget if the driver supports it). VMA only refreshes
+	// the budget in vmaSetCurrentFrameIndex
+	uint64_t GetDeviceMemoryOverBudget() const;
+
+	// Whether images with this format can be uploaded to and sampled from.
+	// Block compressed formats also need the matching device feature, which
+	// is enabled whenever the GPU supports it
+	bool SupportsTextureFormat(VkFormat format) const;
+
+	// Whether the mip chain of images with this format can be generated with
+	// linear filtered blits
+	bool SupportsMipmapGeneration(VkFormat format) const;
+
+	// Records blits that fill mip levels 1 to mipLevels - 1 of an image
+	// uploaded with keepForMipmaps, each from the one above it, and
+	// transitions the whole image to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+	// Blits need a graphics queue, so this goes into a frame's command buffer
+	// (outside of the render pass) once the upload has completed
+	void GenerateMipmaps(VkCommandBuffer cmd, VkImage image, VkExtent3D extent,
+	                     uint32_t mipLevels);
+
+	// Makes an image shareable between the graphics and the transfer queue
+	// families if they differ. queueFamilies has to outlive imageInfo
+	void FillImageQueueFamilies(VkImageCreateInfo &imageInfo,
+	                            uint32_t (&queueFamilies)[2]) const;
+
+	FrameData &GetCurrentFrame() {
+		return Frames[CurrentFrameIndex];
+	}
+
+	// Moves on to the next FrameData in the ring, has to be called once at the
+	// end of every frame
+	void AdvanceFrame() {
+		CurrentFrameIndex = (CurrentFrameIndex + 1) % (uint32_t)Frames.size();
+	}
+
+	// Makes sure the current frame's quads buffer can hold at least quadCount
+	// quads, replacing it with a bigger one (and updating its descriptor set)
+	// if it can't. Whatever was in the old one is dropped. Must only be
+	// called after the frame's RenderFence has been waited on
+	void EnsureQuadsBufferCapacity(uint32_t quadCount);
+
+	// Adds a quad to the current frame. It's only written into the quads
+	// buffer by SortQuads
+	void PushQuad(const QuadData &quad, int16_t layer) {
+		FrameData &frame = GetCurrentFrame();
+
+		uint64_t sequence = frame.Quads.size();
+		if (sequence >> QUAD_KEY_SEQUENCE_BITS) {
+			throw std::runtime_error("Too many quads in a single frame");
 		}
 
-		void flush(const VkContext &context) {
-			for (auto it = deletors.rbegin(); it != deletors.rend(); it++) {
-				(*it)(context);
-			}
+		frame.Quads.push_back(quad);
+		frame.QuadKeys.push_back(quadSortKey(quad, layer) | sequence);
+	}
+
+	// Adds quads whose keys (without the sequence part) were already
+	// computed, e.g. by a DrawList on another thread. They're drawn in the
+	// order they're given in, after the quads pushed so far
+	void PushQuads(std::span<const QuadData> quads,
+	               std::span<const uint64_t> keys) {
+		FrameData &frame = GetCurrentFrame();
 
-			deletors.clear();
+		uint64_t firstSequence = frame.Quads.size();
+		if ((firstSequence + quads.size()) >> QUAD_KEY_SEQUENCE_BITS) {
+			throw std::runtime_error("Too many quads in a single frame");
 		}
-	};
 
-	DeletionQueue DeletionQueue;
+		frame.Quads.insert(frame.Quads.end(), quads.begin(), quads.end());
 
-	void ImmediateSubmit(std::function<void(VkCommandBuffer cmd)> &&function);
+		frame.QuadKeys.reserve(frame.QuadKeys.size() + keys.size());
+		for (size_t i = 0; i < keys.size(); i++) {
+			frame.QuadKeys.push_back(keys[i] | (firstSequence + i));
+		}
+	}
+
+	// Drops the quads pushed this frame that are entirely outside of the
+	// viewport, before they're sorted and written into the quads buffer. The
+	// viewport is the size the projection matrix maps onto the window.
+	// Returns how many were dropped
+	uint32_t CullQuads(float viewportWidth, float viewportHeight) {
+		FrameData &frame = GetCurrentFrame();
+		return azu::CullQuads(frame.Quads, frame.QuadKeys, viewportWidth,
+		                      viewportHeight);
+	}
 
-	void FillQuadsBuffer(std::span<QuadData> quadData);
+	// Sorts the quads pushed this frame by their keys and writes them into
+	// the frame's quads buffer in that order
+	void SortQuads();
+
+	// Splits quads with sorted keys into batches, keeping their order.
+	// Consecutive quads of a layer that need the same pipeline variant (and
+	// texture) end up in the same batch, and short runs are merged into the
+	// batch before them (see MIN_QUAD_BATCH_SIZE) as long as that doesn't mix
+	// textures or layers
+	void BatchQuads(std::span<const uint64_t> keys,
+	                std::vector<QuadBatch> &batches) const;
+
+	// Makes sure the sprites buffer can hold at least spriteCount sprites,
+	// replacing it with a bigger one if it can't. Returns true if it was
+	// replaced, in which case every sprite has to be uploaded again
+	bool EnsureSpritesBufferCapacity(uint32_t spriteCount);
+
+	// Room for count sprites in the current frame's staging buffer, which
+	// RecordSpritesUpload copies from
+	QuadData *StageSprites(uint32_t count);
+
+	// Records the copies of the staged sprites into the sprites buffer, which
+	// can't be inside a render pass. regions are in bytes
+	void RecordSpritesUpload(VkCommandBuffer cmd,
+	                         std::span<const VkBufferCopy> regions);
+
+	// Records the culling of the sprites in batches against the viewport
+	// (the same as CullQuads'), which can't be inside a render pass. Every
+	// batch's visible sprites end up at the front of its range in the
+	// current frame's culled sprites buffer, in the same order, and its
+	// SpriteCullBatch in the current frame's batches buffer gets the draw for
+	// them
+	void CullSprites(VkCommandBuffer cmd, std::span<const QuadBatch> batches,
+	                 float viewportWidth, float viewportHeight);
+
+	// The current frame's set 0 for drawing from the culled sprites buffer
+	VkDescriptorSet GetSpritesDescriptorSet();
+
+	// Flushes the range of the current frame's quads buffer that was written
+	// with PushQuad, so it's visible to the GPU even on non-coherent memory
+	void FlushQuadsBuffer();
+
+	// Writes the pipeline cache to PipelineCachePath if anything was added
+	// to it since it was loaded or last saved
+	void SavePipelineCache();
+
+	// Destroys and recreates the swapchain and its framebuffers with the
+	// current WindowExtent and present mode settings. The device has to be
+	// idle
+	void RecreateSwapchain();
 
 	void HandleWindowResize(VkExtent2D newWindowExtent);
+
+	void SetPresentMode(VkPresentModeKHR presentMode,
+	                    uint32_t minSwapchainImageCount);
+
+	// Copies the offscreen image of a headless context into tightly packed
+	// RGBA8 pixels. Waits for the device to go idle first
+	std::vector<uint8_t> ReadOffscreenImage();
 };
 
 } // namespace azu
@@ -225,6 +225,23 @@ vk_init::pipelineColorBlendAttachmentState() {
 	return colorBlendAttachment;
 }
 
+VkPipelineDepthStencilStateCreateInfo
+vk_init::pipelineDepthStencilStateCreateInfo(bool depthTest, bool depthWrite,
+                                             VkCompareOp compareOp) {
+	VkPipelineDepthStencilStateCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	info.pNext = nullptr;
+
+	info.depthTestEnable       = depthTest ? VK_TRUE : VK_FALSE;
+	info.depthWriteEnable      = depthWrite ? VK_TRUE : VK_FALSE;
+	info.depthCompareOp        = depthTest ? compareOp : VK_COMPARE_OP_ALWAYS;
+	info.depthBoundsTestEnable = VK_FALSE;
+	info.minDepthBounds        = 0.0f;
+	info.maxDepthBounds        = 1.0f;
+	info.stencilTestEnable     = VK_FALSE;
+	return info;
+}
+
 VkPipelineLayoutCreateInfo vk_init::pipelineLayoutCreateInfo(
     std::span<VkPushConstantRange> pushConstantRanges,
     std::span<VkDescriptorSetLayout> descriptorSetLayouts) {
@@ -254,7 +271,8 @@ VkBufferCreateInfo vk_init::bufferCreateInfo(uint32_t size,
 
 VkImageCreateInfo vk_init::imageCreateInfo(VkFormat format,
                                            VkImageUsageFlags usageFlags,
-                                           VkExtent3D extent) {
+                                           VkExtent3D extent,
+                                           uint32_t mipLevels) {
 	VkImageCreateInfo info = {};
 	info.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	info.pNext             = nullptr;
@@ -264,7 +282,7 @@ VkImageCreateInfo vk_init::imageCreateInfo(VkFormat format,
 	info.format = format;
 	info.extent = extent;
 
-	info.mipLevels   = 1;
+	info.mipLevels   = mipLevels;
 	info.arrayLayers = 1;
 	info.samples     = VK_SAMPLE_COUNT_1_BIT;
 	info.tiling      = VK_IMAGE_TILING_OPTIMAL;
@@ -50,6 +50,10 @@ VkPipelineMultisampleStateCreateInfo pipelineMultisampleStateCreateInfo();
 
 VkPipelineColorBlendAttachmentState pipelineColorBlendAttachmentState();
 
+VkPipelineDepthStencilStateCreateInfo
+pipelineDepthStencilStateCreateInfo(bool depthTest, bool depthWrite,
+                                    VkCompareOp compareOp);
+
 VkPipelineLayoutCreateInfo
 pipelineLayoutCreateInfo(std::span<VkPushConstantRange> pushConstantRanges,
                          std::span<VkDescriptorSetLayout> descriptorSetLayouts);
@@ -57,7 +61,7 @@ pipelineLayoutCreateInfo(std::span<VkPushConstantRange> pushConstantRanges,
 VkBufferCreateInfo bufferCreateInfo(uint32_t size, VkBufferUsageFlags usage);
 
 VkImageCreateInfo imageCreateInfo(VkFormat format, VkImageUsageFlags usageFlags,
-                                  VkExtent3D extent);
+                                  VkExtent3D extent, uint32_t mipLevels = 1);
 
 VkSamplerCreateInfo samplerCreateInfo(VkFilter filters,
                                       VkSamplerAddressMode samplerAddressMode);
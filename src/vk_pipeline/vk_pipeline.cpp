@@ -3,7 +3,8 @@
 using namespace azu;
 
 std::optional<VkPipeline> PipelineBuilder::Build(VkDevice device,
-                                                 VkRenderPass pass) {
+                                                 VkRenderPass pass,
+                                                 VkPipelineCache cache) {
 	VkPipelineViewportStateCreateInfo viewportState = {};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.pNext = nullptr;
@@ -37,14 +38,15 @@ std::optional<VkPipeline> PipelineBuilder::Build(VkDevice device,
 	pipelineInfo.pRasterizationState = &Rasterizer;
 	pipelineInfo.pMultisampleState   = &Multisampling;
 	pipelineInfo.pColorBlendState    = &colorBlending;
+	pipelineInfo.pDepthStencilState  = &DepthStencil;
 	pipelineInfo.layout              = PipelineLayout;
 	pipelineInfo.renderPass          = pass;
 	pipelineInfo.subpass             = 0;
 	pipelineInfo.basePipelineHandle  = VK_NULL_HANDLE;
 
 	VkPipeline newPipeline;
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-	                              nullptr, &newPipeline) != VK_SUCCESS) {
+	if (vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr,
+	                              &newPipeline) != VK_SUCCESS) {
 		// failed to create pipeline
 		return std::nullopt;
 	} else {
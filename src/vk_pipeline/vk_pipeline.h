@@ -16,9 +16,11 @@ struct PipelineBuilder {
 	VkPipelineRasterizationStateCreateInfo Rasterizer;
 	VkPipelineColorBlendAttachmentState ColorBlendAttachment;
 	VkPipelineMultisampleStateCreateInfo Multisampling;
+	VkPipelineDepthStencilStateCreateInfo DepthStencil;
 	VkPipelineLayout PipelineLayout;
 
-	std::optional<VkPipeline> Build(VkDevice device, VkRenderPass pass);
+	std::optional<VkPipeline> Build(VkDevice device, VkRenderPass pass,
+	                                VkPipelineCache cache = VK_NULL_HANDLE);
 };
 
 } // namespace azu